@@ -29,9 +29,102 @@ IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
 CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
 */
 
+// On a host, put host/ on the include path to get a minimal stand-in.
 #include <Particle.h>
 
-Logger retlog("ret-atomic");
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+// Lets a reader waiting in readCommitted() give the CPU to the writer.
+#ifndef PRA_YIELD
+#define PRA_YIELD() os_thread_yield()
+#endif
+
+// Masks interrupts around the constant-time steps of saveFromISR() and the
+// ISR-safe commit. Both macros must be used in the same scope.
+#ifndef PRA_ENTER_CRITICAL
+#define PRA_ENTER_CRITICAL() int praIrqState = HAL_disable_irq()
+#define PRA_EXIT_CRITICAL()  HAL_enable_irq(praIrqState)
+#endif
+
+// With dirty tracking, each checksum is derived from the previous page's, so
+// a write that was not recorded leaves later checksums wrong too. Every
+// PRA_CHECKSUM_ANCHOR-th commit checksums and copies the whole page instead,
+// which bounds the damage to that many commits. 0 never does.
+#ifndef PRA_CHECKSUM_ANCHOR
+#define PRA_CHECKSUM_ANCHOR 16
+#endif
+
+// Once ISRs write an object, each commit copies and checksums the whole page
+// with interrupts enabled, and starts over if an ISR saved meanwhile. save()
+// gives up after this many attempts, leaving the save pending for flush(), so
+// an ISR saving faster than sizeof(T) can be copied cannot hang it.
+#ifndef PRA_ISR_RETRIES
+#define PRA_ISR_RETRIES 8
+#endif
+
+#include <atomic>
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+
+// Hardware CRC support. ARMv8 cores with the CRC extension are detected at
+// compile time; on x86 the SSE4.2 path is also compiled in when the build does
+// not already target SSE4.2, and selected at run time by CPUID.
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#define PRA_CRC32_ARM 1
+#elif defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <nmmintrin.h>
+#define PRA_CRC32C_SSE42 1
+#endif
+
+// Vector units used by the byte-sum checksum
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+/**
+ * Returns the logger of this library
+ *
+ * A function-local static, so every translation unit that includes this
+ * header shares one Logger and the header can be included more than once
+ * in a program.
+ */
+inline Logger& retlog(void) {
+  static Logger logger("ret-atomic");
+  return logger;
+}
+
+// Trace logging sits on hot paths (every operator-> call, every SavePage
+// operation), and a disabled Logger call still costs a call plus argument
+// evaluation. It is therefore compiled out entirely unless PRA_ENABLE_TRACE is
+// defined before including this file. Errors and warnings are always logged.
+#if defined(PRA_ENABLE_TRACE)
+#define PRA_TRACE(...) retlog().trace(__VA_ARGS__)
+#else
+#define PRA_TRACE(...) do {} while (0)
+#endif
+
+// Keeps the compiler from reordering stores to retained memory across the
+// commit points of save(). A reset, or a killed process on a host, sees a
+// single core's stores in program order, so a compiler barrier is all that
+// is needed; it emits no instructions.
+#define PRA_STORE_BARRIER() std::atomic_signal_fence(std::memory_order_seq_cst)
+
+// Every store the library makes into retained pages goes through one of these
+// two macros. A power-fail model can define them before including this file to
+// see each store, and tear or drop it, at word or byte granularity. Stores the
+// application makes through the scratchpad pointer are not routed here.
+#ifndef PRA_RETAINED_COPY
+#define PRA_RETAINED_COPY(dst, src, len) memcpy((dst), (src), (len))
+#endif
+#ifndef PRA_RETAINED_STORE
+#define PRA_RETAINED_STORE(dst, value) ((dst) = (value))
+#endif
 
 /**
  * A persistent data structure used by the ParticleRetainedAtomic library
@@ -49,270 +142,2586 @@ typedef struct {
   uint32_t checksumB;
 } ParticleRetainedAtomicData_t;
 
-
 /**
- * A helper class template to (relatively) safely and atomically store data across device resets.
- *
- * This class provides a transactional save model to collect changes that are made
- * to the given state storage object of type &lt;T&gt;. Changes can be made freely
- * to that object via
+ * An extended persistent data structure that adds per-chunk checksums
  *
- * `ParticleRetainedAtomicInstance->myMember = 12345;`
+ * Passing this instead of a ParticleRetainedAtomicData_t to the
+ * ParticleRetainedAtomic constructor splits each save page into CHUNK_SIZE
+ * chunks, each with its own checksum. The page checksum then becomes a root
+ * checksum over the chunk checksums and the sequence number.
  *
- * A call to `ParticleRetainedAtomicInstance.save()` will then freeze this
- * change and store it to RAM. Changes made after the `save()` but before another
- * `save()` call will be lost after a reboot.
+ * This lets save() rehash only the chunks that were written (with dirty
+ * tracking enabled), and lets the constructor tell which chunk of a page is
+ * corrupt, and repair it from the other page when that chunk is unchanged there.
  *
- * See README.md for detailed examples.
+ * Like ParticleRetainedAtomicData_t it must be declared 'retained' and must
+ * not be shared between ParticleRetainedAtomic instances.
  */
 template<typename T>
-class ParticleRetainedAtomic {
+struct ParticleRetainedAtomicChunkedData_t {
+  static const size_t CHUNK_SIZE = 256;
+  static const size_t CHUNKS = (sizeof(T) + CHUNK_SIZE - 1) / CHUNK_SIZE;
 
-private:
+  ParticleRetainedAtomicData_t pages;   // sequence numbers and root checksums
+  uint32_t chunks[2][CHUNKS];           // chunk checksums of page A and page B
+};
 
-  template<typename U>
-  class SavePage {
+/**
+ * A persistent commit record shared by the objects in a transaction
+ *
+ * Used by ParticleRetainedAtomicTransaction to commit several
+ * ParticleRetainedAtomic objects at a single commit point, the store to
+ * committedTxn. It must be declared 'retained' and passed to the constructor
+ * of every participating object, so that each can tell on restart whether the
+ * page it prepared for a transaction was committed.
+ */
+struct ParticleRetainedAtomicCommitRecord_t {
+  uint32_t nextTxn;             // last transaction number handed out
+  uint32_t committedTxn;        // last transaction that reached its commit point
 
-  private:
-    T& m_data;
-    uint16_t& m_seqNum;
-    uint32_t& m_checksum;
-    uint32_t calculateChecksum();
+  static uint32_t tag(uint32_t txn);
+};
 
-  public:
-    friend class ParticleRetainedAtomic;
+/**
+ * Derives the checksum tag of a transaction
+ *
+ * A prepared page stores its checksum XORed with this tag. The tag is never 0,
+ * which would make the page valid before the commit point.
+ *
+ * @param txn  Transaction number
+ * @return Tag for txn
+ */
+inline uint32_t ParticleRetainedAtomicCommitRecord_t::tag(uint32_t txn) {
+  uint32_t h = txn * 0x9E3779B1;         // murmur3 finalizer over a golden ratio multiply
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  if (h == 0) h = 0x5BD1E995;
+  return h;
+}
+
+/**
+ * A persistent data structure for a ring of N save pages
+ *
+ * Passed together with an array of N retained pages to the ParticleRetainedAtomic
+ * ring constructor. Each save() commits to the next page of the ring, so the
+ * N - 1 most recent saves stay recoverable and writes are spread over all pages.
+ *
+ * Like ParticleRetainedAtomicData_t it must be declared 'retained' and must
+ * not be shared between ParticleRetainedAtomic instances.
+ */
+template<size_t N>
+struct ParticleRetainedAtomicRingData_t {
+  uint16_t seqNum[N];
+  uint32_t checksum[N];
+};
 
-    SavePage(U& data, uint16_t& seqnum, uint32_t& checksum);
 
-    void init(const U& initData);            // initializes the SavePage data area
-    void clearChecksum(void);                // overrwrites checksum
-    bool isValid(void);                      // checks checksum
-    void writeChecksum(void);                // writes new checksum
-    SavePage<U>& operator=(const SavePage<U>& rhs);
-  };
+/**
+ * Lookup tables for the slicing-by-8 CRC-32 engine
+ *
+ * entry[0] is the classic byte-at-a-time table for the given (reflected)
+ * polynomial. entry[k] advances a table value by k additional zero bytes,
+ * which lets the engine fold 8 input bytes per step with 8 independent lookups.
+ *
+ * x2n[k] holds x^(2^k) modulo the polynomial. It is used to advance a CRC over
+ * a run of zero bytes in O(log n) time, which is how a change in the middle of
+ * a page is folded into an existing CRC (see replace()).
+ *
+ * The tables are built by a constexpr constructor, so they are computed by the
+ * compiler and placed in flash rather than RAM.
+ */
+template<uint32_t Polynomial>
+struct ParticleRetainedAtomicCrc32Tables {
+  uint32_t entry[8][256];
+  uint32_t x2n[32];
+
+  // a * b modulo the polynomial, both in reflected bit order
+  static constexpr uint32_t multiply(uint32_t a, uint32_t b) {
+    uint32_t product = 0;
+    for (uint32_t m = 0x80000000; m; m >>= 1) {
+      if (a & m) product ^= b;
+      b = (b & 1) ? (b >> 1) ^ Polynomial : (b >> 1);
+    }
+    return product;
+  }
+
+  constexpr ParticleRetainedAtomicCrc32Tables() : entry(), x2n() {
+    for (uint32_t n = 0; n < 256; n++) {
+      uint32_t crc = n;
+      for (int bit = 0; bit < 8; bit++) {
+        crc = (crc & 1) ? (crc >> 1) ^ Polynomial : (crc >> 1);
+      }
+      entry[0][n] = crc;
+    }
+    for (uint32_t n = 0; n < 256; n++) {
+      for (int k = 1; k < 8; k++) {
+        entry[k][n] = (entry[k-1][n] >> 8) ^ entry[0][entry[k-1][n] & 0xff];
+      }
+    }
+    x2n[0] = 0x40000000;    // x^1
+    for (int k = 1; k < 32; k++) {
+      x2n[k] = multiply(x2n[k-1], x2n[k-1]);
+    }
+  }
+};
+
+/**
+ * A table-driven CRC-32 engine using the slicing-by-8 method
+ *
+ * The engine is parameterized on the reflected generator polynomial, so the
+ * same code serves CRC-32 (IEEE 802.3) and CRC-32C (Castagnoli). See the
+ * typedefs below.
+ *
+ * update() follows the zlib convention: it accepts and returns a finished CRC
+ * value, so a CRC over several discontiguous buffers can be built by chaining
+ * calls starting from 0.
+ *
+ * Where the CPU has CRC instructions for the polynomial (SSE4.2 `crc32` for
+ * CRC-32C, ARMv8 `__crc32cd`/`__crc32d` for both) update() uses them instead
+ * of the tables. The result is identical either way.
+ *
+ * The CRC of a fixed-length message is affine over GF(2), so when a few bytes
+ * of a page change its CRC can be updated from the old value instead of being
+ * recomputed; see replace().
+ */
+template<uint32_t Polynomial>
+class ParticleRetainedAtomicCrc32Engine {
 
-  SavePage<T> m_a, m_b;
+private:
+  static constexpr ParticleRetainedAtomicCrc32Tables<Polynomial> s_tables = ParticleRetainedAtomicCrc32Tables<Polynomial>();
+  static uint32_t load32(const uint8_t* p);
+  static uint32_t updateTable(uint32_t crc, const void* data, size_t length);
+  static uint32_t raw(const void* data, size_t length);
+  static uint32_t shift(uint32_t raw, size_t bytes);
 
-  SavePage<T>* m_scratchpad;  // points to m_dataA or m_dataB
-  SavePage<T>* m_saved;       // points to m_dataB or m_dataA
+#if defined(PRA_CRC32_ARM)
+  static uint32_t updateArm(uint32_t crc, const void* data, size_t length);
+#elif defined(PRA_CRC32C_SSE42)
+  static bool hasSse42(void);
+  static uint32_t updateSse42(uint32_t crc, const void* data, size_t length);
+#endif
 
 public:
+  static uint32_t update(uint32_t crc, const void* data, size_t length);
+  static uint32_t calculate(const void* data, size_t length);
+  static uint32_t calculate(const void* data, size_t length, uint16_t seqNum);
 
-  ParticleRetainedAtomic(T& retainedPageA, T& retainedPageB, ParticleRetainedAtomicData_t& retainedData, const T& defaultValue);
-  T& getScratchpad();     // returns a reference to the scratchpad object/data
-  T* operator->(void);    // thisobject->youraccessor
-  void save(void);
+  static uint32_t replace(uint32_t crc, size_t pageLength, size_t offset, const void* oldData, const void* newData, size_t length);
+  static uint32_t replaceSeqNum(uint32_t crc, size_t pageLength, uint16_t oldSeqNum, uint16_t newSeqNum);
 
 };
 
+template<uint32_t Polynomial>
+constexpr ParticleRetainedAtomicCrc32Tables<Polynomial> ParticleRetainedAtomicCrc32Engine<Polynomial>::s_tables;
+
+typedef ParticleRetainedAtomicCrc32Engine<0xEDB88320> ParticleRetainedAtomicCrc32;   // IEEE 802.3
+typedef ParticleRetainedAtomicCrc32Engine<0x82F63B78> ParticleRetainedAtomicCrc32C;  // Castagnoli
 
 /**
- * Construct a SavePage object that points to the given data and checksum
- * @param data     A retained data type
- * @param seqnum   A retained uint16_t that holds the sequence number
- * @param checksum A retained uint32_t that holds the data checksum
+ * Reads a little-endian 32-bit word from an arbitrarily aligned address
+ *
+ * GCC folds this into a single load on little-endian targets that allow
+ * unaligned access (Cortex-M3/M4, x86).
  */
-template <typename T> template <typename U> inline
-ParticleRetainedAtomic<T>::SavePage<U>::SavePage(U& data, uint16_t& seqnum, uint32_t& checksum) :
-m_data(data), m_seqNum(seqnum), m_checksum(checksum) {
-  retlog.trace("SavePage constructor");
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::load32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
 }
 
 /**
- * Initialize the SavePage with given data
- * @param initData Reference to data default value
+ * Continues a CRC calculation over another buffer
+ * @param crc    CRC of the preceding data, or 0 to start a new calculation
+ * @param data   Pointer to the data to add
+ * @param length Number of bytes to add
+ * @return CRC of all data so far
  */
-template <typename T> template <typename U> inline
-void ParticleRetainedAtomic<T>::SavePage<U>::init(const U& initData) {
-  m_data = initData;
-  m_seqNum = 1;
-  retlog.trace("SavePage init");
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::update(uint32_t crc, const void* data, size_t length) {
+#if defined(PRA_CRC32_ARM)
+  if (Polynomial == 0x82F63B78 || Polynomial == 0xEDB88320) return updateArm(crc, data, length);
+#elif defined(PRA_CRC32C_SSE42)
+  if (Polynomial == 0x82F63B78 && hasSse42()) return updateSse42(crc, data, length);
+#endif
+  return updateTable(crc, data, length);
 }
 
 /**
- * Invalidates a data page
- *
- * Modifies the data page checksum to make it invlaid.
+ * Portable slicing-by-8 implementation of update()
  */
-template <typename T> template <typename U> inline
-void ParticleRetainedAtomic<T>::SavePage<U>::clearChecksum() {
-  m_checksum = ~(m_checksum);
-  retlog.trace("SavePage clearChecksum");
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::updateTable(uint32_t crc, const void* data, size_t length) {
+
+  const uint32_t (*t)[256] = s_tables.entry;
+  const uint8_t* p = (const uint8_t*)data;
+
+  crc = ~crc;
+
+  // 8 bytes per step: the first word is folded into the running CRC, the
+  // second is looked up on its own, and all 8 lookups are independent.
+  while (length >= 8) {
+    uint32_t lo = crc ^ load32(p);
+    uint32_t hi = load32(p + 4);
+
+    crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^ t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+          t[3][hi & 0xff] ^ t[2][(hi >> 8) & 0xff] ^ t[1][(hi >> 16) & 0xff] ^ t[0][hi >> 24];
+
+    p += 8;
+    length -= 8;
+  }
+
+  while (length--) {
+    crc = (crc >> 8) ^ t[0][(crc ^ *(p++)) & 0xff];
+  }
+
+  return ~crc;
 }
 
+#if defined(PRA_CRC32_ARM)
 /**
- * Checks the checksum against the data in object
- * @return true if valid checksum is found
+ * ARMv8 CRC extension implementation of update()
  */
-template <typename T> template <typename U> inline
-bool ParticleRetainedAtomic<T>::SavePage<U>::isValid() {
-  retlog.trace("SavePage isValid (stored:%lu calc:%lu)", m_checksum, calculateChecksum());
-  return (calculateChecksum() == m_checksum);
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::updateArm(uint32_t crc, const void* data, size_t length) {
+
+  const uint8_t* p = (const uint8_t*)data;
+  uint64_t word;
+
+  crc = ~crc;
+
+  while (length >= 8) {
+    memcpy(&word, p, sizeof(word));
+    crc = (Polynomial == 0x82F63B78) ? __crc32cd(crc, word) : __crc32d(crc, word);
+    p += 8;
+    length -= 8;
+  }
+
+  while (length--) {
+    crc = (Polynomial == 0x82F63B78) ? __crc32cb(crc, *p) : __crc32b(crc, *p);
+    p++;
+  }
+
+  return ~crc;
 }
 
+#elif defined(PRA_CRC32C_SSE42)
 /**
- * Saves a current checksum
+ * Checks once whether the CPU supports SSE4.2
  */
-template <typename T> template <typename U> inline
-void ParticleRetainedAtomic<T>::SavePage<U>::writeChecksum() {
-  m_checksum = calculateChecksum();
-  retlog.trace("SavePage writeChecksum %lu", m_checksum);
+template<uint32_t Polynomial> inline
+bool ParticleRetainedAtomicCrc32Engine<Polynomial>::hasSse42() {
+#if defined(__SSE4_2__)
+  return true;
+#else
+  // may run from a global constructor, before the CPU model is initialized
+  static const bool supported = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2"));
+  return supported;
+#endif
 }
 
 /**
- * Copies the data referenced in the SavePage object to another SavePage object
+ * SSE4.2 implementation of update(), CRC-32C only
+ */
+template<uint32_t Polynomial> inline __attribute__((target("sse4.2")))
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::updateSse42(uint32_t crc, const void* data, size_t length) {
+
+  const uint8_t* p = (const uint8_t*)data;
+
+  crc = ~crc;
+
+#if defined(__x86_64__)
+  uint64_t word;
+  while (length >= 8) {
+    memcpy(&word, p, sizeof(word));
+    crc = (uint32_t)_mm_crc32_u64(crc, word);
+    p += 8;
+    length -= 8;
+  }
+#else
+  uint32_t word;
+  while (length >= 4) {
+    memcpy(&word, p, sizeof(word));
+    crc = _mm_crc32_u32(crc, word);
+    p += 4;
+    length -= 4;
+  }
+#endif
+
+  while (length--) {
+    crc = _mm_crc32_u8(crc, *(p++));
+  }
+
+  return ~crc;
+}
+#endif
+
+/**
+ * Calculates the CRC of a buffer without the initial and final inversion
  *
- * Since this class only stores references to 'retained' memory that was declared
- * in the global scope, this makes it possible to write that referenced data from
- * one SavePage to another with a simpler notation.
+ * This "raw" CRC is linear: raw(a ^ b) == raw(a) ^ raw(b).
+ */
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::raw(const void* data, size_t length) {
+  return ~update(0xffffffff, data, length);
+}
+
+/**
+ * Advances a raw CRC over a run of zero bytes
+ * @param raw    Raw CRC
+ * @param bytes  Number of zero bytes that follow
+ * @return raw * x^(8 * bytes) modulo the polynomial, in O(log bytes) steps
+ */
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::shift(uint32_t raw, size_t bytes) {
+
+  unsigned k = 3;     // 8 bits per byte == 2^3
+
+  while (bytes) {
+    if (bytes & 1) raw = s_tables.multiply(s_tables.x2n[k & 31], raw);
+    bytes >>= 1;
+    k++;
+  }
+
+  return raw;
+}
+
+/**
+ * Updates the CRC of a save page after part of its data changed
  *
- * @note This automatically increments the seqNum
+ * Changing bytes [offset, offset + length) XORs the message with a difference
+ * that is zero everywhere else, so the CRC changes by the raw CRC of that
+ * difference advanced over the bytes that follow it (the rest of the data and
+ * the two sequence number bytes).
  *
- * @param rhs   Right operand
+ * @param crc         CRC of the page before the change, as returned by calculate()
+ * @param pageLength  Length of the page data
+ * @param offset      Offset of the changed range
+ * @param oldData     Previous contents of the range
+ * @param newData     New contents of the range
+ * @param length      Length of the range
+ * @return CRC of the page after the change
  */
-template <typename T> template <typename U> inline
-ParticleRetainedAtomic<T>::SavePage<U>& ParticleRetainedAtomic<T>::SavePage<U>::operator=(const SavePage<U>& rhs) {
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::replace(uint32_t crc, size_t pageLength, size_t offset,
+                                                               const void* oldData, const void* newData, size_t length) {
+  uint32_t delta = raw(oldData, length) ^ raw(newData, length);
+  return crc ^ shift(delta, pageLength - offset - length + 2);
+}
 
-retlog.trace("SavePage operator=");
-  if (this == &rhs) return *this;
+/**
+ * Updates the CRC of a save page after its sequence number changed
+ * @param crc         CRC of the page before the change, as returned by calculate()
+ * @param pageLength  Length of the page data
+ * @param oldSeqNum   Previous sequence number
+ * @param newSeqNum   New sequence number
+ * @return CRC of the page after the change
+ */
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::replaceSeqNum(uint32_t crc, size_t pageLength, uint16_t oldSeqNum, uint16_t newSeqNum) {
+  (void)pageLength;
+  const uint16_t diff = oldSeqNum ^ newSeqNum;
+  const uint8_t seq[2] = { (uint8_t)(diff & 0xff), (uint8_t)((0xff00 & diff) >> 8) };
+  return crc ^ raw(seq, sizeof(seq));
+}
 
-  m_data      = rhs.m_data;
+/**
+ * Calculates the CRC of a single buffer
+ * @param data   Pointer to the data
+ * @param length Number of bytes
+ * @return CRC of the data
+ */
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::calculate(const void* data, size_t length) {
+  return update(0, data, length);
+}
 
-  // zero seqNum is invalid
-  if (rhs.m_seqNum == UINT16_MAX) m_seqNum = 1;
-  else                            m_seqNum = rhs.m_seqNum+1;
+/**
+ * Calculates the CRC of a save page (checksum policy interface)
+ * @param data   Pointer to the page data
+ * @param length Number of bytes
+ * @param seqNum Page sequence number, appended little-endian after the data
+ * @return CRC of the data and sequence number
+ */
+template<uint32_t Polynomial> inline
+uint32_t ParticleRetainedAtomicCrc32Engine<Polynomial>::calculate(const void* data, size_t length, uint16_t seqNum) {
+  const uint8_t seq[2] = { (uint8_t)(seqNum & 0xff), (uint8_t)((0xff00 & seqNum) >> 8) };
+  return update(update(0, data, length), seq, sizeof(seq));
+}
 
-  m_checksum  = rhs.m_checksum;
 
-  return *this;
-}
+/**
+ * Complement of the sum of all bytes, compatible with pages saved by the
+ * original version of this library
+ */
+class ParticleRetainedAtomicByteSum {
+
+private:
+  static uint32_t sumBytes(const void* data, size_t length);
+
+public:
+  static uint32_t calculate(const void* data, size_t length);
+  static uint32_t calculate(const void* data, size_t length, uint16_t seqNum);
+
+  static uint32_t replace(uint32_t checksum, size_t pageLength, size_t offset, const void* oldData, const void* newData, size_t length);
+  static uint32_t replaceSeqNum(uint32_t checksum, size_t pageLength, uint16_t oldSeqNum, uint16_t newSeqNum);
 
+};
 
 /**
- * Calculates a sum of all bytes in the saved data in this object
- * @return Sum of bytes of data. If greater than uint32, overflows to 0 and starts over.
+ * Sums all bytes of a buffer, modulo 2^32, a word or vector at a time
+ *
+ * Addition is associative modulo 2^32, so any grouping of the bytes gives the
+ * same result as adding them one by one; each path below only has to make
+ * sure its partial sums cannot overflow before they are folded together.
  *
- * @note This checksum function is extremely rudimentary and is a good candidate
- * for more work.
+ * - SSE2: PSADBW sums 16 bytes into two 64-bit lanes per instruction
+ * - NEON: pairwise widening adds, 16 bytes per step
+ * - ARMv7E-M DSP (Cortex-M4/M33): USADA8 adds 4 bytes per instruction
+ * - otherwise: SIMD-within-a-register on 32-bit words, two 16-bit lanes that
+ *   are folded every 128 words, before they could overflow
  */
-template <typename T> template <typename U> inline
-uint32_t ParticleRetainedAtomic<T>::SavePage<U>::calculateChecksum() {
+inline uint32_t ParticleRetainedAtomicByteSum::sumBytes(const void* data, size_t length) {
 
+  const uint8_t* p = (const uint8_t*)data;
   uint32_t sum = 0;
 
-  uint8_t* p = (uint8_t*)&m_data;
-  const uint8_t* pEnd = (uint8_t*)&m_data + sizeof(T);
+#if defined(__SSE2__)
+  const __m128i zero = _mm_setzero_si128();
+  __m128i acc = zero;
 
-  //retlog.trace("sizeof(T)=%u", sizeof(T));
+  while (length >= 16) {
+    acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const __m128i*)p), zero));
+    p += 16;
+    length -= 16;
+  }
 
-  do {
-    //retlog.trace("sum: %x pval: %x paddr: %p ", sum, *p, p);
+  sum = (uint32_t)_mm_cvtsi128_si32(acc) + (uint32_t)_mm_cvtsi128_si32(_mm_unpackhi_epi64(acc, acc));
+
+#elif defined(__ARM_NEON)
+  uint32x4_t acc = vdupq_n_u32(0);
+
+  while (length >= 16) {
+    acc = vpadalq_u16(acc, vpaddlq_u8(vld1q_u8(p)));
+    p += 16;
+    length -= 16;
+  }
+
+  sum = vgetq_lane_u32(acc, 0) + vgetq_lane_u32(acc, 1) + vgetq_lane_u32(acc, 2) + vgetq_lane_u32(acc, 3);
+
+#elif defined(__ARM_FEATURE_SIMD32)
+  uint32_t word;
+
+  while (length >= 4) {
+    memcpy(&word, p, sizeof(word));
+    __asm__ ("usada8 %0, %1, %2, %0" : "+r" (sum) : "r" (word), "r" (0));
+    p += 4;
+    length -= 4;
+  }
+
+#else
+  uint32_t word;
+
+  while (length >= 4) {
+    size_t block = (length / 4 > 128) ? 128 : length / 4;
+    uint32_t lanes = 0;
+
+    length -= block * 4;
+    do {
+      memcpy(&word, p, sizeof(word));
+      lanes += (word & 0x00ff00ff) + ((word >> 8) & 0x00ff00ff);
+      p += 4;
+    } while (--block);
+
+    sum += (lanes & 0xffff) + (lanes >> 16);
+  }
+#endif
+
+  while (length--) {
     sum += *(p++);
-  } while (p < pEnd);
+  }
 
-  // include sequence number in checksum calculation
-  sum += (0xff00 & m_seqNum) >> 8;
-  sum += m_seqNum & 0xff;
+  return sum;
+}
+
+/**
+ * Calculates the complement of the sum of bytes
+ * @param data   Pointer to the data
+ * @param length Number of bytes
+ * @return Complemented sum of bytes. If greater than uint32, overflows to 0 and starts over.
+ */
+inline uint32_t ParticleRetainedAtomicByteSum::calculate(const void* data, size_t length) {
+  return ~sumBytes(data, length);
+}
+
+/**
+ * Calculates the complement of the sum of bytes of a save page
+ * @param data   Pointer to the page data
+ * @param length Number of bytes
+ * @param seqNum Page sequence number, added as two bytes
+ * @return Complemented sum of bytes of data and sequence number
+ */
+inline uint32_t ParticleRetainedAtomicByteSum::calculate(const void* data, size_t length, uint16_t seqNum) {
+
+  uint32_t sum = sumBytes(data, length);
 
-  retlog.trace("SavePage calculateChecksum sum: %lx checksum: %lx", sum, ~sum);
+  sum += (0xff00 & seqNum) >> 8;
+  sum += seqNum & 0xff;
 
   return ~sum;
 }
 
 /**
- * Create a ParticleRetainedAtomic object to be stored in provided retained RAM pointers
- * @param retainedPageA Reference to retained type T (Page A)
- * @param retainedPageB Reference to retained type T (Page B)
- * @param retainedData  Reference to a retained ParticleRetainedAtomicData_t structure
- * @param defaultValue  Reference to a type T initialized with default values
+ * Updates the checksum of a save page after part of its data changed
+ * @param checksum    Checksum of the page before the change
+ * @param pageLength  Length of the page data (unused, a sum does not depend on position)
+ * @param offset      Offset of the changed range (unused)
+ * @param oldData     Previous contents of the range
+ * @param newData     New contents of the range
+ * @param length      Length of the range
+ * @return Checksum of the page after the change
+ */
+inline uint32_t ParticleRetainedAtomicByteSum::replace(uint32_t checksum, size_t pageLength, size_t offset,
+                                                      const void* oldData, const void* newData, size_t length) {
+  (void)pageLength;
+  (void)offset;
+  return ~(~checksum - sumBytes(oldData, length) + sumBytes(newData, length));
+}
+
+/**
+ * Updates the checksum of a save page after its sequence number changed
+ * @param checksum    Checksum of the page before the change
+ * @param pageLength  Length of the page data (unused)
+ * @param oldSeqNum   Previous sequence number
+ * @param newSeqNum   New sequence number
+ * @return Checksum of the page after the change
+ */
+inline uint32_t ParticleRetainedAtomicByteSum::replaceSeqNum(uint32_t checksum, size_t pageLength, uint16_t oldSeqNum, uint16_t newSeqNum) {
+  (void)pageLength;
+  uint32_t sum = ~checksum;
+  sum -= ((0xff00 & oldSeqNum) >> 8) + (oldSeqNum & 0xff);
+  sum += ((0xff00 & newSeqNum) >> 8) + (newSeqNum & 0xff);
+  return ~sum;
+}
+
+/**
+ * Detects whether a checksum policy can update a checksum incrementally
  *
- * This constructor
- * 1. Retains a reference to the provided retained data structures/objects for use
- * 2. Checks checksums and copies the valid page (Page A or Page B) to the other page
- * 3. If both are valid, use the page with the most recent sequence number
- * 4. If neither are valid, copy the defaultValue and save
+ * A policy supports this by providing static replace() and replaceSeqNum()
+ * functions with the signatures of ParticleRetainedAtomicByteSum.
  */
-template<typename T> inline
-ParticleRetainedAtomic<T>::ParticleRetainedAtomic(
-                T& retainedPageA,
-                T& retainedPageB,
-                ParticleRetainedAtomicData_t& retainedData,
-                const T& defaultValue) :
-                m_a(SavePage<T>(retainedPageA, retainedData.seqNumA, retainedData.checksumA)),
-                m_b(SavePage<T>(retainedPageB, retainedData.seqNumB, retainedData.checksumB)) {
+template<typename Policy>
+class ParticleRetainedAtomicIsIncremental {
 
-retlog.trace("ParticleRetainedAtomic constructor");
+private:
+  template<typename P> static char test(decltype(&P::replace), decltype(&P::replaceSeqNum));
+  template<typename P> static long test(...);
 
-  // Remember that when save() is called, m_scratchpad gets checksummed and frozen.
-  if (m_a.isValid()) {
-    if (m_a.m_seqNum == 0)  retlog.error("A is valid but seqence number is zero!!!");
+public:
+  static const bool value = (sizeof(test<Policy>(0, 0)) == sizeof(char));
+
+};
+
+/**
+ * Fletcher-32 checksum
+ *
+ * Data is read as little-endian 16-bit words. An odd trailing byte is padded
+ * with zero. The sequence number is appended as one more word.
+ */
+class ParticleRetainedAtomicFletcher32 {
 
-    if (m_b.isValid()) {
-      if (m_b.m_seqNum == 0) retlog.error("B is valid but sequence number is zero!!!");
+private:
+  static void accumulate(uint32_t& c0, uint32_t& c1, const void* data, size_t length);
 
-      retlog.trace("Both stored pages are valid! Using sequence number to resolve. A:%u B:%u", m_a.m_seqNum, m_b.m_seqNum);
+public:
+  static uint32_t calculate(const void* data, size_t length);
+  static uint32_t calculate(const void* data, size_t length, uint16_t seqNum);
 
-      if (m_a.m_seqNum > m_b.m_seqNum || (m_b.m_seqNum == UINT16_MAX && m_a.m_seqNum == 1)) {
-        m_scratchpad = &m_a;
-        m_saved = &m_b;
-      }
-      else if (m_b.m_seqNum > m_a.m_seqNum || (m_a.m_seqNum == UINT16_MAX && m_b.m_seqNum == 1)) {
-        m_scratchpad = &m_b;
-        m_saved = &m_a;
-      }
-      else {
-        retlog.error("Something went wrong validating the sequence numbers. Restored default values.");
-        m_a.init(defaultValue);
-        m_scratchpad = &m_a;
-        m_saved = &m_b;
-      }
-    }
-    else {  // !m_b.isValid(), so use page A
-      m_scratchpad = &m_a;
-      m_saved = &m_b;
-    }
-  }
-  else if (m_b.isValid()) {
-    m_scratchpad = &m_b;
-    m_saved = &m_a;
+};
+
+/**
+ * Adds data to a pair of Fletcher-32 running sums
+ *
+ * The modulo is only taken every 359 words, the most that can be summed
+ * without overflowing 32 bits.
+ */
+inline void ParticleRetainedAtomicFletcher32::accumulate(uint32_t& c0, uint32_t& c1, const void* data, size_t length) {
+
+  const uint8_t* p = (const uint8_t*)data;
+  size_t words = length / 2;
+
+  while (words) {
+    size_t block = (words > 359) ? 359 : words;
+    words -= block;
+    do {
+      c0 += (uint32_t)p[0] | ((uint32_t)p[1] << 8);
+      c1 += c0;
+      p += 2;
+    } while (--block);
+    c0 %= 65535;
+    c1 %= 65535;
   }
-  else {  // no valid page, copy default value to page A then save it.
-    retlog.trace("No valid pages, values set from default!");
-    m_a.init(defaultValue);
-    m_scratchpad = &m_a;
-    m_saved = &m_b;
+
+  if (length & 1) {
+    c0 = (c0 + *p) % 65535;
+    c1 = (c1 + c0) % 65535;
   }
-  save();
 }
 
-
 /**
- * Returns a reference to the scratchpad data object
- *
- * This object should be used to save data to the scratchpad object.
- *
- * @return A reference to scratchpad data object of template type &lt;T&gt;
+ * Calculates the Fletcher-32 checksum of a buffer
+ * @param data   Pointer to the data
+ * @param length Number of bytes
+ * @return Fletcher-32 checksum
  */
-template<typename T> inline
-T& ParticleRetainedAtomic<T>::getScratchpad() {
-  retlog.trace("ParticleRetainedAtomic getScratchpad");
-  return m_scratchpad->m_data;
+inline uint32_t ParticleRetainedAtomicFletcher32::calculate(const void* data, size_t length) {
+  uint32_t c0 = 0, c1 = 0;
+  accumulate(c0, c1, data, length);
+  return (c1 << 16) | c0;
 }
 
 /**
- * An alias for getScratchpad()
- *
- * This operator alias should allow the usage ParticleRetainedAtomicObject->templateTypeAccessor
- * where templateTypeAccessor is a member of the templated class type.
- *
- * @note operator-> must return a void* type which allows it to be used by the
- * caller in the expected way, although GCC seems to be aware of the type and
- * can do static, compile time member checks on the T type object.
+ * Calculates the Fletcher-32 checksum of a save page
+ * @param data   Pointer to the page data
+ * @param length Number of bytes
+ * @param seqNum Page sequence number, appended as a final word
+ * @return Fletcher-32 checksum of data and sequence number
  */
-template<typename T> inline
-T* ParticleRetainedAtomic<T>::operator->() {
-  retlog.trace("ParticleRetainedAtomic operator->");
-  return &(this->getScratchpad());
+inline uint32_t ParticleRetainedAtomicFletcher32::calculate(const void* data, size_t length, uint16_t seqNum) {
+  uint32_t c0 = 0, c1 = 0;
+  accumulate(c0, c1, data, length);
+  c0 = (c0 + seqNum) % 65535;
+  c1 = (c1 + c0) % 65535;
+  return (c1 << 16) | c0;
+}
+
+/**
+ * Adler-32 checksum, as used by zlib
+ *
+ * The sequence number is appended as two little-endian bytes.
+ */
+class ParticleRetainedAtomicAdler32 {
+
+private:
+  static uint32_t update(uint32_t adler, const void* data, size_t length);
+
+public:
+  static uint32_t calculate(const void* data, size_t length);
+  static uint32_t calculate(const void* data, size_t length, uint16_t seqNum);
+
+};
+
+/**
+ * Continues an Adler-32 calculation over another buffer
+ *
+ * The modulo is only taken every 5552 bytes, the most that can be summed
+ * without overflowing 32 bits.
+ */
+inline uint32_t ParticleRetainedAtomicAdler32::update(uint32_t adler, const void* data, size_t length) {
+
+  const uint8_t* p = (const uint8_t*)data;
+  uint32_t a = adler & 0xffff;
+  uint32_t b = adler >> 16;
+
+  while (length) {
+    size_t block = (length > 5552) ? 5552 : length;
+    length -= block;
+    do {
+      a += *(p++);
+      b += a;
+    } while (--block);
+    a %= 65521;
+    b %= 65521;
+  }
+
+  return (b << 16) | a;
+}
+
+/**
+ * Calculates the Adler-32 checksum of a buffer
+ * @param data   Pointer to the data
+ * @param length Number of bytes
+ * @return Adler-32 checksum
+ */
+inline uint32_t ParticleRetainedAtomicAdler32::calculate(const void* data, size_t length) {
+  return update(1, data, length);
+}
+
+/**
+ * Calculates the Adler-32 checksum of a save page
+ * @param data   Pointer to the page data
+ * @param length Number of bytes
+ * @param seqNum Page sequence number, appended little-endian after the data
+ * @return Adler-32 checksum of data and sequence number
+ */
+inline uint32_t ParticleRetainedAtomicAdler32::calculate(const void* data, size_t length, uint16_t seqNum) {
+  const uint8_t seq[2] = { (uint8_t)(seqNum & 0xff), (uint8_t)((0xff00 & seqNum) >> 8) };
+  return update(update(1, data, length), seq, sizeof(seq));
+}
+
+/**
+ * xxHash32 non-cryptographic hash
+ *
+ * The page sequence number is used as the hash seed.
+ */
+class ParticleRetainedAtomicXxHash32 {
+
+private:
+  static const uint32_t PRIME1 = 2654435761U;
+  static const uint32_t PRIME2 = 2246822519U;
+  static const uint32_t PRIME3 = 3266489917U;
+  static const uint32_t PRIME4 = 668265263U;
+  static const uint32_t PRIME5 = 374761393U;
+
+  static uint32_t rotl(uint32_t x, int r);
+  static uint32_t load32(const uint8_t* p);
+  static uint32_t round(uint32_t acc, uint32_t input);
+
+public:
+  static uint32_t calculate(const void* data, size_t length);
+  static uint32_t calculate(const void* data, size_t length, uint32_t seed);
+
+};
+
+inline uint32_t ParticleRetainedAtomicXxHash32::rotl(uint32_t x, int r) {
+  return (x << r) | (x >> (32 - r));
+}
+
+inline uint32_t ParticleRetainedAtomicXxHash32::load32(const uint8_t* p) {
+  return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+inline uint32_t ParticleRetainedAtomicXxHash32::round(uint32_t acc, uint32_t input) {
+  return rotl(acc + input * PRIME2, 13) * PRIME1;
+}
+
+/**
+ * Calculates the xxHash32 of a buffer with seed 0
+ * @param data   Pointer to the data
+ * @param length Number of bytes
+ * @return xxHash32 of the data
+ */
+inline uint32_t ParticleRetainedAtomicXxHash32::calculate(const void* data, size_t length) {
+  return calculate(data, length, (uint32_t)0);
+}
+
+/**
+ * Calculates the xxHash32 of a buffer
+ * @param data   Pointer to the data
+ * @param length Number of bytes
+ * @param seed   Hash seed; for save pages this is the sequence number
+ * @return xxHash32 of the data
+ */
+inline uint32_t ParticleRetainedAtomicXxHash32::calculate(const void* data, size_t length, uint32_t seed) {
+
+  const uint8_t* p = (const uint8_t*)data;
+  const uint8_t* pEnd = p + length;
+  uint32_t h;
+
+  if (length >= 16) {
+    uint32_t v1 = seed + PRIME1 + PRIME2;
+    uint32_t v2 = seed + PRIME2;
+    uint32_t v3 = seed;
+    uint32_t v4 = seed - PRIME1;
+
+    do {
+      v1 = round(v1, load32(p));
+      v2 = round(v2, load32(p + 4));
+      v3 = round(v3, load32(p + 8));
+      v4 = round(v4, load32(p + 12));
+      p += 16;
+    } while (pEnd - p >= 16);
+
+    h = rotl(v1, 1) + rotl(v2, 7) + rotl(v3, 12) + rotl(v4, 18);
+  }
+  else {
+    h = seed + PRIME5;
+  }
+
+  h += (uint32_t)length;
+
+  while (pEnd - p >= 4) {
+    h = rotl(h + load32(p) * PRIME3, 17) * PRIME4;
+    p += 4;
+  }
+
+  while (p < pEnd) {
+    h = rotl(h + *(p++) * PRIME5, 11) * PRIME1;
+  }
+
+  h ^= h >> 15;
+  h *= PRIME2;
+  h ^= h >> 13;
+  h *= PRIME3;
+  h ^= h >> 16;
+
+  return h;
+}
+
+
+/**
+ * A fixed-size bitmap with one bit per block of a save page
+ *
+ * Used by ParticleRetainedAtomic to record which blocks of the scratchpad have
+ * been modified since the last save(), so that only those need to be copied.
+ */
+template<size_t Blocks>
+class ParticleRetainedAtomicBlockMap {
+
+private:
+  static const size_t WORDS = (Blocks + 31) / 32;
+  uint32_t m_bits[WORDS];
+
+public:
+  ParticleRetainedAtomicBlockMap();
+
+  void clear(void);                               // unmarks all blocks
+  void setAll(void);                              // marks all blocks
+  void set(size_t first, size_t end);             // marks blocks [first, end)
+  void reset(size_t first, size_t end);           // unmarks blocks [first, end)
+  void merge(const ParticleRetainedAtomicBlockMap& other);  // marks the blocks marked in other
+  bool test(size_t block) const;                  // true if block is marked
+  bool any(void) const;                           // true if any block is marked
+  size_t count(void) const;                       // number of marked blocks
+  bool nextRun(size_t& first, size_t& end) const; // finds the next run of marked blocks
+
+};
+
+template<size_t Blocks> inline
+ParticleRetainedAtomicBlockMap<Blocks>::ParticleRetainedAtomicBlockMap() {
+  clear();
+}
+
+template<size_t Blocks> inline
+void ParticleRetainedAtomicBlockMap<Blocks>::clear() {
+  for (size_t i = 0; i < WORDS; i++) m_bits[i] = 0;
+}
+
+template<size_t Blocks> inline
+void ParticleRetainedAtomicBlockMap<Blocks>::setAll() {
+  for (size_t i = 0; i < WORDS; i++) m_bits[i] = 0xffffffff;
+
+  // keep bits past the last block clear so nextRun() never reports them
+  if (Blocks % 32) m_bits[WORDS - 1] = (1UL << (Blocks % 32)) - 1;
+}
+
+template<size_t Blocks> inline
+void ParticleRetainedAtomicBlockMap<Blocks>::set(size_t first, size_t end) {
+  if (end > Blocks) end = Blocks;
+  for (size_t b = first; b < end; b++) m_bits[b / 32] |= 1UL << (b % 32);
+}
+
+template<size_t Blocks> inline
+void ParticleRetainedAtomicBlockMap<Blocks>::reset(size_t first, size_t end) {
+  if (end > Blocks) end = Blocks;
+  for (size_t b = first; b < end; b++) m_bits[b / 32] &= ~(1UL << (b % 32));
+}
+
+template<size_t Blocks> inline
+void ParticleRetainedAtomicBlockMap<Blocks>::merge(const ParticleRetainedAtomicBlockMap& other) {
+  for (size_t i = 0; i < WORDS; i++) m_bits[i] |= other.m_bits[i];
+}
+
+template<size_t Blocks> inline
+bool ParticleRetainedAtomicBlockMap<Blocks>::test(size_t block) const {
+  return (m_bits[block / 32] >> (block % 32)) & 1;
+}
+
+template<size_t Blocks> inline
+bool ParticleRetainedAtomicBlockMap<Blocks>::any() const {
+  for (size_t i = 0; i < WORDS; i++) {
+    if (m_bits[i]) return true;
+  }
+  return false;
+}
+
+template<size_t Blocks> inline
+size_t ParticleRetainedAtomicBlockMap<Blocks>::count() const {
+  size_t n = 0;
+  for (size_t i = 0; i < WORDS; i++) n += __builtin_popcountl(m_bits[i]);
+  return n;
+}
+
+/**
+ * Finds the next run of consecutive marked blocks
+ * @param first  In: block to start searching at. Out: first block of the run
+ * @param end    Out: one past the last block of the run
+ * @return true if a run was found
+ */
+template<size_t Blocks> inline
+bool ParticleRetainedAtomicBlockMap<Blocks>::nextRun(size_t& first, size_t& end) const {
+
+  size_t b = first;
+
+  while (b < Blocks && !test(b)) {
+    if (b % 32 == 0 && m_bits[b / 32] == 0) b += 32;    // skip empty words
+    else                                    b++;
+  }
+  if (b >= Blocks) return false;
+
+  first = b;
+  while (b < Blocks && test(b)) b++;
+  end = b;
+
+  return true;
+}
+
+
+/**
+ * A helper class template to (relatively) safely and atomically store data across device resets.
+ *
+ * This class provides a transactional save model to collect changes that are made
+ * to the given state storage object of type &lt;T&gt;. Changes can be made freely
+ * to that object via
+ *
+ * `ParticleRetainedAtomicInstance->myMember = 12345;`
+ *
+ * A call to `ParticleRetainedAtomicInstance.save()` will then freeze this
+ * change and store it to RAM. Changes made after the `save()` but before another
+ * `save()` call will be lost after a reboot.
+ *
+ * The optional ChecksumPolicy parameter selects the algorithm used to validate
+ * save pages. A policy is any type with a static
+ *
+ * `uint32_t calculate(const void* data, size_t length, uint16_t seqNum)`
+ *
+ * that folds both the page data and its sequence number into the result. The
+ * call is resolved at compile time, so the chosen kernel is inlined into
+ * save() with no indirection. Shipped policies, roughly from fastest/weakest
+ * to slowest/strongest:
+ *
+ * - ParticleRetainedAtomicByteSum    complement of a sum of bytes (the original algorithm)
+ * - ParticleRetainedAtomicFletcher32 Fletcher-32 over little-endian 16-bit words
+ * - ParticleRetainedAtomicAdler32    Adler-32 as used by zlib
+ * - ParticleRetainedAtomicXxHash32   xxHash32, seeded with the sequence number
+ * - ParticleRetainedAtomicCrc32C     CRC-32C, slicing-by-8 (default)
+ * - ParticleRetainedAtomicCrc32      CRC-32 (IEEE 802.3), slicing-by-8
+ *
+ * @warning Changing the policy of an existing object changes the stored
+ * checksums: previously saved pages will not validate and the state is
+ * restored from its default value once.
+ *
+ * By default save() copies the whole of &lt;T&gt; to the other page. With
+ * setDirtyTracking(true), writes made through set(), modify() or markDirty()
+ * are recorded per BLOCK_SIZE block, in a buffer supplied by
+ * setTrackingBuffer(), and save() copies only those blocks.
+ * setLazySync(true) goes further and defers even that copy until the blocks
+ * are next written.
+ *
+ * The optional N parameter sets the number of save pages. With more than two,
+ * pages are used in turn and the N - 1 most recent saves stay recoverable; use
+ * the constructor taking an array of pages and a ParticleRetainedAtomicRingData_t.
+ *
+ * See README.md for detailed examples.
+ */
+class ParticleRetainedAtomicTransaction;
+
+template<typename T, typename ChecksumPolicy = ParticleRetainedAtomicCrc32C, size_t N = 2>
+class ParticleRetainedAtomic {
+
+  friend class ParticleRetainedAtomicTransaction;
+
+public:
+
+  static const size_t BLOCK_SIZE = 32;  // dirty tracking granularity, in bytes
+
+  enum SaveMode {
+    Immediate,    // save() brings the other page up to date before returning
+    Deferred      // save() leaves that to sync()
+  };
+
+  static const size_t MAX_SAVEPOINTS = 4;   // savepoint nesting depth
+
+  struct UndoEntry {                        // one block of the scratchpad, as it was before a write
+    size_t block;
+    uint8_t data[BLOCK_SIZE];
+  };
+
+  class Snapshot {                          // pins a saved page for reading, see acquireSnapshot()
+
+  private:
+    const T* m_data;
+    std::atomic<uint32_t>* m_readers;
+
+  public:
+    Snapshot(const T* data, std::atomic<uint32_t>* readers);
+    Snapshot(Snapshot&& other);
+    Snapshot(const Snapshot&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    ~Snapshot();
+
+    const T& operator*(void) const;
+    const T* operator->(void) const;
+  };
+
+  class WorkingCopy {                       // private copy of the saved data, see beginTransaction()
+
+  private:
+    ParticleRetainedAtomic* m_owner;
+    uint32_t m_version;                     // m_readSeq of the saved data copied
+    T m_data;
+
+  public:
+    explicit WorkingCopy(ParticleRetainedAtomic* owner);
+
+    T& operator*(void);
+    T* operator->(void);
+    bool commit(void);                      // saves the copy unless another commit came first
+  };
+
+private:
+
+  static const size_t BLOCKS = (sizeof(T) + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  typedef ParticleRetainedAtomicBlockMap<BLOCKS> BlockMap;
+
+  struct Savepoints {                       // savepoint bookkeeping, kept in the undo buffer
+    size_t start[MAX_SAVEPOINTS];           // undo log length when each savepoint was set
+    BlockMap captured[MAX_SAVEPOINTS];      // blocks in the undo log since each savepoint
+  };
+
+public:
+
+  struct TrackingBuffer {                   // storage for dirty tracking and lazy sync, see setTrackingBuffer()
+    BlockMap dirty;                         // blocks of the scratchpad written since the last save()
+    BlockMap pending;                       // blocks of the scratchpad still to be copied from the saved page
+    BlockMap stale[N];                      // blocks in which each page differs from the saved page
+  };
+
+  template<size_t Entries>
+  struct UndoBuffer {                       // storage for savepoints, see setUndoBuffer()
+    Savepoints savepoints;
+    UndoEntry entries[Entries];
+  };
+
+private:
+
+  static const size_t CHUNK_SIZE = ParticleRetainedAtomicChunkedData_t<T>::CHUNK_SIZE;
+  static const size_t CHUNKS = ParticleRetainedAtomicChunkedData_t<T>::CHUNKS;
+
+  template<typename U>
+  class SavePage {
+
+  private:
+    T& m_data;
+    uint16_t& m_seqNum;
+    uint32_t& m_checksum;
+    uint32_t* m_chunks;                      // chunk checksums, or nullptr if not chunked
+    uint32_t calculateChecksum();
+    uint32_t calculateChunkChecksum(size_t chunk);
+    static uint32_t invalidChecksum(uint32_t checksum);
+    void writeChunkChecksums(const BlockMap* blocks);
+    uint32_t calculateChecksum(const SavePage<U>& base, const BlockMap& blocks, std::true_type incremental);
+    uint32_t calculateChecksum(const SavePage<U>& base, const BlockMap& blocks, std::false_type incremental);
+
+  public:
+    friend class ParticleRetainedAtomic;
+
+    SavePage(U& data, uint16_t& seqnum, uint32_t& checksum, uint32_t* chunks = nullptr);
+
+    void init(const U& initData);            // initializes the SavePage data area
+    void clearChecksum(void);                // overrwrites checksum
+    bool isValid(void);                      // checks checksum
+    size_t findCorruptChunk(size_t first);   // first chunk at or after first that fails its checksum
+    void writeChecksum(uint32_t tag = 0);    // writes new checksum, XORed with tag
+    void writeChecksum(const SavePage<U>& base, const BlockMap& blocks, uint32_t tag = 0);  // same, from base + changed blocks
+    SavePage<U>& operator=(const SavePage<U>& rhs);
+    void copyBlocks(const SavePage<U>& rhs, const BlockMap& blocks);  // operator= for marked blocks only
+    void copyRange(const SavePage<U>& rhs, size_t first, size_t end);  // copies data blocks [first, end) only
+  };
+
+  SavePage<T> m_pages[N];
+
+  SavePage<T>* m_scratchpad;  // points into m_pages
+  SavePage<T>* m_saved;       // points to the page before m_scratchpad in the ring
+  T* m_scratchData;           // &m_scratchpad->m_data, so operator-> is a single load
+  std::atomic<const T*> m_savedData;  // &m_saved->m_data, so committed() is a single load
+
+  // Every constructor starts from these values; only m_pages differs between them.
+  TrackingBuffer* m_tracking = nullptr;   // block maps, supplied by setTrackingBuffer()
+  uint32_t m_derived = 0;             // dirty tracked commits since the last one of the whole page
+  bool m_dirtyTracking = false;       // save() copies only the dirty blocks
+  bool m_lazySync = false;            // save() leaves the pending blocks to be copied on first write
+  bool m_syncPending = false;         // the pending map may have marked blocks
+
+  Savepoints* m_savepointMaps = nullptr;        // bookkeeping, supplied by setUndoBuffer()
+  UndoEntry* m_undo = nullptr;                  // undo log, supplied by setUndoBuffer()
+  size_t m_undoCapacity = 0;
+  size_t m_undoLength = 0;
+  size_t m_savepoints = 0;                      // number of active savepoints
+  bool m_undoOverflow = false;                  // the undo log was full when a block had to be captured
+
+  uint32_t m_commitWindowMs = 0;      // save() commits at most once per this many ms, 0 for no limit
+  uint32_t m_commitWindowCalls = 0;   // ... or once per this many calls, 0 for no limit
+  uint32_t m_lastCommit = 0;          // millis() at the last commit
+  uint32_t m_coalesced = 0;           // save() calls since the last commit
+
+  std::atomic<uint32_t> m_readSeq{0};     // seqlock for readCommitted(), odd while a commit overwrites a page
+  std::atomic<uint32_t> m_readers[N]{};   // snapshots pinning each page
+  std::atomic<bool> m_committing{false};  // held by every commit and revert, see lockCommits()
+  std::atomic<uint32_t> m_isrEpoch{0};    // incremented by every saveFromISR()
+  uint32_t m_isrCommitted = 0;            // m_isrEpoch covered by the last commitISRSaves()
+  std::atomic<bool> m_isrWrites{false};   // ISRs write the scratchpad, so commits must not trust the dirty map
+
+  template<size_t... I>
+  ParticleRetainedAtomic(T (&retainedPages)[N], ParticleRetainedAtomicRingData_t<N>& retainedData, std::index_sequence<I...>);
+
+  static bool isNewer(uint16_t seqNum, uint16_t than);
+  static bool validateCommitted(SavePage<T>& page, const ParticleRetainedAtomicCommitRecord_t& record);
+  SavePage<T>* nextPage(SavePage<T>* page);
+  SavePage<T>* findLegacyPage(void);  // newest page with a byte-sum checksum from an earlier version
+  size_t pageIndex(const T* data) const;
+  uint32_t readVersion(T& copy) const;               // readCommitted(), returning m_readSeq
+  bool commitWorkingCopy(const T& data, uint32_t version);
+  void lockCommits(void);             // spinlock serializing the methods that commit or revert pages
+  void unlockCommits(void);
+  void restore(const T& defaultValue, const bool* valid);
+  bool validatePage(SavePage<T>& page, SavePage<T>& other, char name);
+  void swapPages(bool deferred);
+  void markPagesStale(void);          // every page but the scratchpad may hold any older generation
+  void syncBlocks(size_t first, size_t end);  // copies pending blocks in [first, end) from the saved page
+  void captureBlocks(size_t first, size_t end);  // logs blocks in [first, end) for the innermost savepoint
+  void clearSavepoints(void);
+  bool commit(SaveMode mode);         // save() without the commit window; false if ISRs kept saving
+  void writeChecksum(uint32_t tag);   // checksums the scratchpad, derived from the saved page where allowed
+  bool commitAroundISRs(uint32_t requested);  // full copy and checksum, swapped unless an ISR saved meanwhile
+  void prepare(uint32_t tag);         // first phase of a transaction: tagged checksum
+  void finish(uint32_t tag);          // after the commit point: real checksum, then swap
+
+public:
+
+  ParticleRetainedAtomic(T& retainedPageA, T& retainedPageB, ParticleRetainedAtomicData_t& retainedData, const T& defaultValue);
+  ParticleRetainedAtomic(T& retainedPageA, T& retainedPageB, ParticleRetainedAtomicChunkedData_t<T>& retainedData, const T& defaultValue);
+  ParticleRetainedAtomic(T (&retainedPages)[N], ParticleRetainedAtomicRingData_t<N>& retainedData, const T& defaultValue);
+  ParticleRetainedAtomic(T& retainedPageA, T& retainedPageB, ParticleRetainedAtomicData_t& retainedData, const T& defaultValue,
+                         const ParticleRetainedAtomicCommitRecord_t& commitRecord);
+  ParticleRetainedAtomic(T (&retainedPages)[N], ParticleRetainedAtomicRingData_t<N>& retainedData, const T& defaultValue,
+                         const ParticleRetainedAtomicCommitRecord_t& commitRecord);
+  T& getScratchpad();     // returns a reference to the scratchpad object/data
+  T* operator->(void);    // thisobject->youraccessor
+  void save(void);
+  void save(SaveMode mode);
+  bool sync(size_t maxBytes = SIZE_MAX);  // brings the scratchpad up to date, returns true when done
+
+  void setCommitWindow(uint32_t ms, uint32_t calls = 0);  // coalesces save() calls
+  bool flush(void);                   // commits saves held back by the commit window
+  bool commitPending(void) const;     // true if the commit window is holding back a save
+
+  const T& committed(void) const;     // returns a reference to the last saved data
+  const T& operator*(void) const;     // alias for committed()
+  void readCommitted(T& copy) const;  // copies the last saved data, safe from other threads
+  Snapshot acquireSnapshot(void);     // pins the last saved data, safe from other threads
+  WorkingCopy beginTransaction(void); // private copy to update and commit, safe from other threads
+
+  T* scratchpadFromISR(void);         // scratchpad for interrupt context, never syncs
+  void saveFromISR(void);             // requests a save from interrupt context, constant time
+  void setISRWrites(void);            // declares up front that ISRs will write the scratchpad
+  bool commitISRSaves(void);          // completes requested saves from thread context
+  uint16_t savedSeqNum(void) const;   // sequence number of the last saved data
+
+  void revert(void);                  // discards changes made since the last save()
+  bool rollbackTo(uint16_t seqNum);   // saves an earlier, still valid generation again
+
+  template<size_t Entries> void setUndoBuffer(UndoBuffer<Entries>* buffer);  // storage for savepoints
+  void setUndoBuffer(std::nullptr_t);                   // disables savepoints
+  bool savepoint(void);               // marks the current scratchpad state
+  bool rollbackToSavepoint(void);     // undoes the writes made since the innermost savepoint
+  void releaseSavepoint(void);        // keeps them and drops the innermost savepoint
+
+  void setTrackingBuffer(TrackingBuffer* buffer);       // storage for dirty tracking and lazy sync
+  void setDirtyTracking(bool enable);                   // opt in to partial page copies
+  void setLazySync(bool enable);                        // opt in to pointer-swap commits
+  void markDirty(size_t offset, size_t length);         // records a write to the scratchpad
+  template<typename M> M& modify(M T::*member);         // marks member dirty and returns it
+  template<typename M> void set(M T::*member, const M& value);
+
+};
+
+
+/**
+ * Construct a SavePage object that points to the given data and checksum
+ * @param data     A retained data type
+ * @param seqnum   A retained uint16_t that holds the sequence number
+ * @param checksum A retained uint32_t that holds the data checksum
+ * @param chunks   Retained array of CHUNKS chunk checksums, or nullptr. If given,
+ *                 checksum holds the root checksum over this array.
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::SavePage(U& data, uint16_t& seqnum, uint32_t& checksum, uint32_t* chunks) :
+m_data(data), m_seqNum(seqnum), m_checksum(checksum), m_chunks(chunks) {
+  PRA_TRACE("SavePage constructor");
+}
+
+/**
+ * Initialize the SavePage with given data
+ * @param initData Reference to data default value
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::init(const U& initData) {
+  PRA_RETAINED_COPY(&m_data, &initData, sizeof(U));
+  PRA_RETAINED_STORE(m_seqNum, (uint16_t)1);
+  PRA_TRACE("SavePage init");
+}
+
+/**
+ * Scrambles a checksum into one that no page is expected to match
+ *
+ * Not an inversion: inverting a copied checksum and inverting it again when
+ * the page is next invalidated would store the original, and a weak policy
+ * such as ParticleRetainedAtomicByteSum can match it against stale data with
+ * an incremented sequence number. The scrambled value bears no arithmetic
+ * relation to the data, however often it is applied.
+ *
+ * @param checksum  Checksum to scramble
+ * @return Scrambled checksum
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+uint32_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::invalidChecksum(uint32_t checksum) {
+  uint32_t h = (checksum ^ 0xA5A5A5A5) * 0xCC9E2D51;   // murmur3 finalizer
+  h ^= h >> 16;
+  h *= 0x85EBCA6B;
+  h ^= h >> 13;
+  h *= 0xC2B2AE35;
+  h ^= h >> 16;
+  return h == checksum ? ~h : h;
+}
+
+/**
+ * Invalidates a data page
+ *
+ * Modifies the data page checksum to make it invlaid.
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::clearChecksum() {
+  PRA_RETAINED_STORE(m_checksum, invalidChecksum(m_checksum));
+  PRA_TRACE("SavePage clearChecksum");
+}
+
+/**
+ * Checks the checksum against the data in object
+ *
+ * For a chunked page, both the root checksum and every chunk checksum must match.
+ *
+ * @return true if valid checksum is found
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::isValid() {
+  uint32_t checksum = calculateChecksum();     // computed once, trace arguments are always evaluated
+  PRA_TRACE("SavePage isValid (stored:%lu calc:%lu)", m_checksum, checksum);
+  if (checksum != m_checksum) return false;
+  return (m_chunks == nullptr || findCorruptChunk(0) == CHUNKS);
+}
+
+/**
+ * Finds a chunk whose data does not match its stored chunk checksum
+ * @param first  First chunk to check
+ * @return Index of the corrupt chunk, or CHUNKS if none is found
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+size_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::findCorruptChunk(size_t first) {
+  for (size_t chunk = first; chunk < CHUNKS; chunk++) {
+    if (calculateChunkChecksum(chunk) != m_chunks[chunk]) return chunk;
+  }
+  return CHUNKS;
+}
+
+/**
+ * Saves a current checksum
+ *
+ * For a chunked page, all chunk checksums are recalculated first.
+ *
+ * @param tag  Nonzero to store the checksum XORed with a transaction tag, so the
+ *             page is only valid once that transaction commits
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::writeChecksum(uint32_t tag) {
+  if (m_chunks) writeChunkChecksums(nullptr);
+  uint32_t checksum = calculateChecksum();
+  PRA_STORE_BARRIER();                   // everything the checksum covers is stored first
+  PRA_RETAINED_STORE(m_checksum, checksum ^ tag);
+  PRA_TRACE("SavePage writeChecksum %lu", m_checksum);
+}
+
+/**
+ * Saves a current checksum, derived from another page where possible
+ *
+ * If the checksum policy supports incremental updates and only a few blocks
+ * changed, the checksum is computed from the checksum of base plus the changed
+ * blocks, in time proportional to the number of changed bytes. Otherwise it
+ * is recalculated over the whole page.
+ *
+ * For a chunked page, only the chunks containing marked blocks are rehashed
+ * and the root checksum is recalculated over the chunk checksums.
+ *
+ * @param base    A page with a valid checksum that matches this page everywhere
+ *                except in the marked blocks and the sequence number
+ * @param blocks  Blocks that differ between base and this page
+ * @param tag     Transaction tag, see writeChecksum(uint32_t)
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::writeChecksum(const SavePage<U>& base, const BlockMap& blocks, uint32_t tag) {
+  uint32_t checksum;
+
+  if (m_chunks) {
+    writeChunkChecksums(&blocks);
+    checksum = calculateChecksum();
+  }
+  else {
+    std::integral_constant<bool, ParticleRetainedAtomicIsIncremental<ChecksumPolicy>::value> incremental;
+    checksum = calculateChecksum(base, blocks, incremental);
+  }
+
+  PRA_STORE_BARRIER();                   // everything the checksum covers is stored first
+  PRA_RETAINED_STORE(m_checksum, checksum ^ tag);
+  PRA_TRACE("SavePage writeChecksum %lu", m_checksum);
+}
+
+/**
+ * Copies the data referenced in the SavePage object to another SavePage object
+ *
+ * Since this class only stores references to 'retained' memory that was declared
+ * in the global scope, this makes it possible to write that referenced data from
+ * one SavePage to another with a simpler notation.
+ *
+ * Chunk checksums are copied along with the data, so they stay valid for every
+ * chunk that is not modified afterwards.
+ *
+ * @note This automatically increments the seqNum, and stores rhs's checksum
+ * scrambled (see invalidChecksum()), so the copy never validates before its
+ * own checksum is written
+ *
+ * @param rhs   Right operand
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>& ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::operator=(const SavePage<U>& rhs) {
+
+PRA_TRACE("SavePage operator=");
+  if (this == &rhs) return *this;
+
+  PRA_RETAINED_COPY(&m_data, &rhs.m_data, sizeof(U));
+  if (m_chunks) PRA_RETAINED_COPY(m_chunks, rhs.m_chunks, CHUNKS * sizeof(uint32_t));
+
+  // zero seqNum is invalid
+  PRA_RETAINED_STORE(m_seqNum, (uint16_t)(rhs.m_seqNum == UINT16_MAX ? 1 : rhs.m_seqNum+1));
+
+  // invalid as stored: rhs's checksum could happen to match the new sequence number
+  PRA_RETAINED_STORE(m_checksum, invalidChecksum(rhs.m_checksum));
+
+  return *this;
+}
+
+
+/**
+ * Copies the marked blocks of another SavePage object to this one
+ *
+ * Equivalent to operator= when this page already matches rhs everywhere
+ * except in the marked blocks.
+ *
+ * @note This automatically increments the seqNum, and stores rhs's checksum
+ * scrambled, like operator=
+ *
+ * @param rhs     Page to copy from
+ * @param blocks  Blocks of rhs that differ from this page
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::copyBlocks(const SavePage<U>& rhs, const BlockMap& blocks) {
+
+  PRA_TRACE("SavePage copyBlocks");
+  if (this == &rhs) return;
+
+  size_t first = 0, end;
+
+  while (blocks.nextRun(first, end)) {
+    copyRange(rhs, first, end);
+    first = end;
+  }
+  if (m_chunks) PRA_RETAINED_COPY(m_chunks, rhs.m_chunks, CHUNKS * sizeof(uint32_t));
+
+  // zero seqNum is invalid
+  PRA_RETAINED_STORE(m_seqNum, (uint16_t)(rhs.m_seqNum == UINT16_MAX ? 1 : rhs.m_seqNum+1));
+
+  // invalid as stored: rhs's checksum could happen to match the new sequence number
+  PRA_RETAINED_STORE(m_checksum, invalidChecksum(rhs.m_checksum));
+}
+
+/**
+ * Copies a range of data blocks of another SavePage object to this one
+ *
+ * Neither the sequence number nor any checksum is touched.
+ *
+ * @param rhs   Page to copy from
+ * @param first First block to copy
+ * @param end   One past the last block to copy
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::copyRange(const SavePage<U>& rhs, size_t first, size_t end) {
+  size_t offset = first * BLOCK_SIZE;
+  size_t length = (end * BLOCK_SIZE > sizeof(T)) ? sizeof(T) - offset : (end - first) * BLOCK_SIZE;
+  PRA_RETAINED_COPY((uint8_t*)&m_data + offset, (const uint8_t*)&rhs.m_data + offset, length);
+}
+
+/**
+ * Calculates the checksum of the saved data and sequence number in this object
+ *
+ * For a chunked page this is the root checksum over the stored chunk
+ * checksums and the sequence number; the chunk data itself is not read.
+ *
+ * @return Checksum as defined by the ChecksumPolicy template parameter
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+uint32_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::calculateChecksum() {
+
+  // include sequence number in checksum calculation
+  uint32_t checksum = m_chunks ? ChecksumPolicy::calculate(m_chunks, CHUNKS * sizeof(uint32_t), m_seqNum)
+                               : ChecksumPolicy::calculate(&m_data, sizeof(T), m_seqNum);
+
+  PRA_TRACE("SavePage calculateChecksum checksum: %lx", checksum);
+
+  return checksum;
+}
+
+/**
+ * Calculates the checksum of one chunk of the data in this object
+ *
+ * The chunk index takes the place of the sequence number, so a chunk that ends
+ * up at the wrong offset does not validate.
+ *
+ * @param chunk Chunk index
+ * @return Checksum as defined by the ChecksumPolicy template parameter
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+uint32_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::calculateChunkChecksum(size_t chunk) {
+  size_t offset = chunk * CHUNK_SIZE;
+  size_t length = (offset + CHUNK_SIZE > sizeof(T)) ? sizeof(T) - offset : CHUNK_SIZE;
+  return ChecksumPolicy::calculate((uint8_t*)&m_data + offset, length, (uint16_t)chunk);
+}
+
+/**
+ * Recalculates the stored chunk checksums
+ * @param blocks  Only chunks containing a marked block are rehashed, or all
+ *                chunks if nullptr
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::writeChunkChecksums(const BlockMap* blocks) {
+
+  const size_t blocksPerChunk = CHUNK_SIZE / BLOCK_SIZE;
+  size_t first = 0, end;
+
+  if (blocks == nullptr) {
+    for (size_t chunk = 0; chunk < CHUNKS; chunk++) PRA_RETAINED_STORE(m_chunks[chunk], calculateChunkChecksum(chunk));
+    return;
+  }
+
+  while (blocks->nextRun(first, end)) {
+    for (size_t chunk = first / blocksPerChunk; chunk * blocksPerChunk < end; chunk++) {
+      PRA_RETAINED_STORE(m_chunks[chunk], calculateChunkChecksum(chunk));
+    }
+    first = ((end + blocksPerChunk - 1) / blocksPerChunk) * blocksPerChunk;
+  }
+}
+
+/**
+ * Calculates the checksum of this page from the checksum of base and the
+ * blocks that differ from it
+ * @return Checksum as defined by the ChecksumPolicy template parameter
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+uint32_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::calculateChecksum(const SavePage<U>& base, const BlockMap& blocks, std::true_type) {
+
+  // each changed byte is read from both pages, so past half the page a full pass is cheaper
+  if (blocks.count() > BLOCKS / 2) return calculateChecksum();
+
+  const uint8_t* oldData = (const uint8_t*)&base.m_data;
+  const uint8_t* newData = (const uint8_t*)&m_data;
+  size_t first = 0, end;
+
+  uint32_t checksum = ChecksumPolicy::replaceSeqNum(base.m_checksum, sizeof(T), base.m_seqNum, m_seqNum);
+
+  while (blocks.nextRun(first, end)) {
+    size_t offset = first * BLOCK_SIZE;
+    size_t length = (end * BLOCK_SIZE > sizeof(T)) ? sizeof(T) - offset : (end - first) * BLOCK_SIZE;
+    checksum = ChecksumPolicy::replace(checksum, sizeof(T), offset, oldData + offset, newData + offset, length);
+    first = end;
+  }
+
+  PRA_TRACE("SavePage calculateChecksum incremental checksum: %lx", checksum);
+
+  return checksum;
+}
+
+/**
+ * Policy without incremental support: recalculates over the whole page
+ * @return Checksum as defined by the ChecksumPolicy template parameter
+ */
+template <typename T, typename ChecksumPolicy, size_t N> template <typename U> inline
+uint32_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::SavePage<U>::calculateChecksum(const SavePage<U>&, const BlockMap&, std::false_type) {
+  return calculateChecksum();
+}
+
+/**
+ * Create a ParticleRetainedAtomic object to be stored in provided retained RAM pointers
+ * @param retainedPageA Reference to retained type T (Page A)
+ * @param retainedPageB Reference to retained type T (Page B)
+ * @param retainedData  Reference to a retained ParticleRetainedAtomicData_t structure
+ * @param defaultValue  Reference to a type T initialized with default values
+ *
+ * This constructor
+ * 1. Retains a reference to the provided retained data structures/objects for use
+ * 2. Checks checksums and copies the valid page (Page A or Page B) to the other page
+ * 3. If both are valid, use the page with the most recent sequence number
+ * 4. If neither are valid, copy the defaultValue and save
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::ParticleRetainedAtomic(
+                T& retainedPageA,
+                T& retainedPageB,
+                ParticleRetainedAtomicData_t& retainedData,
+                const T& defaultValue) :
+                m_pages{SavePage<T>(retainedPageA, retainedData.seqNumA, retainedData.checksumA),
+                        SavePage<T>(retainedPageB, retainedData.seqNumB, retainedData.checksumB)} {
+
+  static_assert(N == 2, "use the ring constructor for N != 2");
+
+PRA_TRACE("ParticleRetainedAtomic constructor");
+  bool valid[N] = { m_pages[0].isValid(), m_pages[1].isValid() };
+  restore(defaultValue, valid);
+}
+
+/**
+ * Create a ParticleRetainedAtomic object with per-chunk checksums
+ * @param retainedPageA Reference to retained type T (Page A)
+ * @param retainedPageB Reference to retained type T (Page B)
+ * @param retainedData  Reference to a retained ParticleRetainedAtomicChunkedData_t structure
+ * @param defaultValue  Reference to a type T initialized with default values
+ *
+ * Works like the constructor above. In addition, a page whose root checksum is
+ * intact but which has corrupt chunks is reported chunk by chunk, and each
+ * corrupt chunk is repaired from the other page if that page still holds the
+ * data the chunk checksum was computed over.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::ParticleRetainedAtomic(
+                T& retainedPageA,
+                T& retainedPageB,
+                ParticleRetainedAtomicChunkedData_t<T>& retainedData,
+                const T& defaultValue) :
+                m_pages{SavePage<T>(retainedPageA, retainedData.pages.seqNumA, retainedData.pages.checksumA, retainedData.chunks[0]),
+                        SavePage<T>(retainedPageB, retainedData.pages.seqNumB, retainedData.pages.checksumB, retainedData.chunks[1])} {
+
+  static_assert(N == 2, "chunked checksums are only supported with two pages");
+
+PRA_TRACE("ParticleRetainedAtomic chunked constructor");
+  bool valid[N] = { validatePage(m_pages[0], m_pages[1], 'A'), validatePage(m_pages[1], m_pages[0], 'B') };
+  restore(defaultValue, valid);
+}
+
+/**
+ * Create a ParticleRetainedAtomic object over a ring of N retained pages
+ * @param retainedPages Reference to a retained array of N type T pages
+ * @param retainedData  Reference to a retained ParticleRetainedAtomicRingData_t&lt;N&gt; structure
+ * @param defaultValue  Reference to a type T initialized with default values
+ *
+ * Works like the two page constructor, with the valid page of the most recent
+ * sequence number restored. The older valid pages are left untouched, except
+ * for the one after it in the ring, which becomes the scratchpad.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::ParticleRetainedAtomic(
+                T (&retainedPages)[N],
+                ParticleRetainedAtomicRingData_t<N>& retainedData,
+                const T& defaultValue) :
+                ParticleRetainedAtomic(retainedPages, retainedData, std::make_index_sequence<N>()) {
+
+PRA_TRACE("ParticleRetainedAtomic ring constructor");
+  bool valid[N];
+  for (size_t i = 0; i < N; i++) valid[i] = m_pages[i].isValid();
+  restore(defaultValue, valid);
+}
+
+/**
+ * Create a ParticleRetainedAtomic object that takes part in transactions
+ * @param retainedPageA Reference to retained type T (Page A)
+ * @param retainedPageB Reference to retained type T (Page B)
+ * @param retainedData  Reference to a retained ParticleRetainedAtomicData_t structure
+ * @param defaultValue  Reference to a type T initialized with default values
+ * @param commitRecord  Reference to the retained commit record of the transactions
+ *
+ * Works like the constructor without a commit record, but a page prepared by
+ * the last committed transaction also counts as valid. Its checksum is then
+ * completed, so a transaction interrupted after its commit point is rolled
+ * forward. Objects committed with ParticleRetainedAtomicTransaction must use
+ * this constructor, or such a page would be discarded.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::ParticleRetainedAtomic(
+                T& retainedPageA,
+                T& retainedPageB,
+                ParticleRetainedAtomicData_t& retainedData,
+                const T& defaultValue,
+                const ParticleRetainedAtomicCommitRecord_t& commitRecord) :
+                m_pages{SavePage<T>(retainedPageA, retainedData.seqNumA, retainedData.checksumA),
+                        SavePage<T>(retainedPageB, retainedData.seqNumB, retainedData.checksumB)} {
+
+  static_assert(N == 2, "use the ring constructor for N != 2");
+
+PRA_TRACE("ParticleRetainedAtomic transactional constructor");
+  bool valid[N] = { validateCommitted(m_pages[0], commitRecord), validateCommitted(m_pages[1], commitRecord) };
+  restore(defaultValue, valid);
+}
+
+/**
+ * Create a ParticleRetainedAtomic object over a ring of pages that takes part in transactions
+ * @param retainedPages Reference to a retained array of N type T pages
+ * @param retainedData  Reference to a retained ParticleRetainedAtomicRingData_t&lt;N&gt; structure
+ * @param defaultValue  Reference to a type T initialized with default values
+ * @param commitRecord  Reference to the retained commit record of the transactions
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::ParticleRetainedAtomic(
+                T (&retainedPages)[N],
+                ParticleRetainedAtomicRingData_t<N>& retainedData,
+                const T& defaultValue,
+                const ParticleRetainedAtomicCommitRecord_t& commitRecord) :
+                ParticleRetainedAtomic(retainedPages, retainedData, std::make_index_sequence<N>()) {
+
+PRA_TRACE("ParticleRetainedAtomic transactional ring constructor");
+  bool valid[N];
+  for (size_t i = 0; i < N; i++) valid[i] = validateCommitted(m_pages[i], commitRecord);
+  restore(defaultValue, valid);
+}
+
+/**
+ * Sets up the SavePage objects of a ring, one per index in I
+ */
+template<typename T, typename ChecksumPolicy, size_t N> template<size_t... I> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::ParticleRetainedAtomic(
+                T (&retainedPages)[N],
+                ParticleRetainedAtomicRingData_t<N>& retainedData,
+                std::index_sequence<I...>) :
+                m_pages{SavePage<T>(retainedPages[I], retainedData.seqNum[I], retainedData.checksum[I])...} {
+
+  static_assert(N >= 2, "a ring needs at least two pages");
+}
+
+/**
+ * Compares two sequence numbers, allowing for wrap-around
+ *
+ * Sequence numbers run from 1 to UINT16_MAX and then start over at 1. Of two
+ * numbers, the one that can be reached from the other by fewer than half a
+ * cycle of increments is the newer one.
+ *
+ * @param seqNum  Sequence number to test
+ * @param than    Sequence number to compare against
+ * @return true if seqNum is newer than than
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::isNewer(uint16_t seqNum, uint16_t than) {
+  uint32_t distance = ((uint32_t)seqNum + UINT16_MAX - than) % UINT16_MAX;
+  return distance != 0 && distance < UINT16_MAX / 2;
+}
+
+/**
+ * Validates a page, accepting a page prepared by the last committed transaction
+ *
+ * Such a page has its checksum XORed with the transaction's tag. The checksum
+ * is completed here, rolling the transaction forward for this object.
+ *
+ * finish() replaces the tagged checksum with the plain one after the commit
+ * point, and a reset can tear that store. Each byte of the stored checksum is
+ * therefore accepted if it matches either the plain or the tagged checksum.
+ *
+ * @param page    Page to check
+ * @param record  Commit record of the transactions
+ * @return true if the page is valid, possibly after completing its checksum
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::validateCommitted(SavePage<T>& page, const ParticleRetainedAtomicCommitRecord_t& record) {
+
+  uint32_t checksum = page.calculateChecksum();
+
+  if (checksum == page.m_checksum) return true;
+  if (record.committedTxn == 0) return false;
+
+  uint32_t tagged = checksum ^ ParticleRetainedAtomicCommitRecord_t::tag(record.committedTxn);
+
+  for (unsigned shift = 0; shift < 32; shift += 8) {
+    uint32_t stored = (page.m_checksum >> shift) & 0xFF;
+    if (stored != ((checksum >> shift) & 0xFF) && stored != ((tagged >> shift) & 0xFF)) return false;
+  }
+
+  retlog().info("Rolling forward committed transaction %lu", (unsigned long)record.committedTxn);
+  PRA_RETAINED_STORE(page.m_checksum, checksum);
+  return true;
+}
+
+/**
+ * Returns the page that follows the given one in the ring
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+typename ParticleRetainedAtomic<T, ChecksumPolicy, N>::template SavePage<T>* ParticleRetainedAtomic<T, ChecksumPolicy, N>::nextPage(SavePage<T>* page) {
+  return (page == &m_pages[N - 1]) ? &m_pages[0] : page + 1;
+}
+
+/**
+ * Looks for a page saved by an earlier version of this library
+ *
+ * Those versions protected each page with a byte sum over the data and the
+ * sequence number, which ParticleRetainedAtomicByteSum still computes. Only
+ * called when no page validates with the current policy, so a device that is
+ * upgraded keeps its state once, rather than restoring the default value.
+ * Chunked pages and sequence number zero were never written by those
+ * versions; the latter also rules out zeroed memory, whose byte sum matches.
+ *
+ * @return Newest page whose byte sum matches, or nullptr
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+typename ParticleRetainedAtomic<T, ChecksumPolicy, N>::template SavePage<T>* ParticleRetainedAtomic<T, ChecksumPolicy, N>::findLegacyPage(void) {
+
+  if (std::is_same<ChecksumPolicy, ParticleRetainedAtomicByteSum>::value) return nullptr;
+
+  SavePage<T>* newest = nullptr;
+  for (size_t i = 0; i < N; i++) {
+    SavePage<T>& page = m_pages[i];
+    if (page.m_chunks || page.m_seqNum == 0) continue;
+    if (ParticleRetainedAtomicByteSum::calculate(&page.m_data, sizeof(T), page.m_seqNum) != page.m_checksum) continue;
+
+    if (newest == nullptr || isNewer(page.m_seqNum, newest->m_seqNum)) newest = &page;
+  }
+  return newest;
+}
+
+/**
+ * Marks every block of every page other than the scratchpad out of date
+ *
+ * Used whenever writes may have gone unrecorded in the stale maps: when dirty
+ * tracking is enabled and after an ISR save. In a ring of more than two pages
+ * the others can hold any older generation, and each must be copied in full
+ * when the ring next comes round to it.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::markPagesStale(void) {
+  if (m_tracking == nullptr) return;
+
+  for (size_t i = 0; i < N; i++) {
+    if (&m_pages[i] != m_scratchpad) m_tracking->stale[i].setAll();
+    else                             m_tracking->stale[i].clear();
+  }
+}
+
+/**
+ * Selects the page to restore from, or restores the default value
+ * @param defaultValue  Reference to a type T initialized with default values
+ * @param valid         Result of validating each page
+ *
+ * Called by the constructors once the SavePage objects are set up and each
+ * page has been checked exactly once. The valid page with the most recent
+ * sequence number is restored. It keeps its checksum, so it is not hashed
+ * again before being copied to the next page. If no page is valid, a page
+ * from an earlier version is converted instead, see findLegacyPage().
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::restore(const T& defaultValue, const bool* valid) {
+
+  SavePage<T>* newest = nullptr;
+  bool ambiguous = false;
+
+  // Remember that when save() is called, m_scratchpad gets checksummed and frozen.
+  for (size_t i = 0; i < N; i++) {
+    if (!valid[i]) continue;
+
+    uint16_t seqNum = m_pages[i].m_seqNum;
+    if (seqNum == 0) retlog().error("%c is valid but sequence number is zero!!!", 'A' + (int)i);
+
+    if (newest == nullptr || isNewer(seqNum, newest->m_seqNum)) {
+      newest = &m_pages[i];
+      ambiguous = false;
+    }
+    else if (seqNum == newest->m_seqNum) {
+      ambiguous = true;
+    }
+  }
+
+  SavePage<T>* legacy = nullptr;
+  if (ambiguous) {
+    retlog().error("Something went wrong validating the sequence numbers. Restored default values.");
+    newest = nullptr;
+  }
+  else if (newest == nullptr && (legacy = findLegacyPage()) == nullptr) {  // no valid page, copy default value to page A then save it.
+    PRA_TRACE("No valid pages, values set from default!");
+  }
+
+  if (legacy != nullptr) {
+    // copy it to the next page and commit that with the current policy; the old page is kept until then
+    retlog().warn("Converting page %c from the byte-sum checksum of an earlier version", 'A' + (int)(legacy - m_pages));
+    m_scratchpad = nextPage(legacy);
+    m_saved = legacy;
+    *m_scratchpad = *legacy;
+    save();
+  }
+  else if (newest == nullptr) {
+    m_pages[0].init(defaultValue);
+    m_scratchpad = &m_pages[0];
+    m_saved = &m_pages[N - 1];
+    save();
+  }
+  else {
+    PRA_TRACE("Restoring page %c, sequence number %u", 'A' + (int)(newest - m_pages), newest->m_seqNum);
+    m_scratchpad = newest;
+    m_saved = &m_pages[N - 1];  // not used until swapPages() sets it
+    swapPages(false);   // checksum of the restored page is already known to be valid
+  }
+  markPagesStale();
+}
+
+/**
+ * Validates a page, reporting and repairing corrupt chunks
+ *
+ * If the root checksum of a chunked page matches its chunk checksums, those
+ * chunk checksums can be trusted even when some chunk data does not match
+ * them. Each such chunk is logged, and replaced with the same chunk of the
+ * other page if that data matches the expected chunk checksum (it is unchanged
+ * since the chunk was last saved).
+ *
+ * Each chunk of the page is hashed once.
+ *
+ * @param page   Page to check
+ * @param other  Page to take replacement chunks from
+ * @param name   Page name used in log messages
+ * @return true if the page is valid, after any repairs
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::validatePage(SavePage<T>& page, SavePage<T>& other, char name) {
+
+  if (page.calculateChecksum() != page.m_checksum) return false;   // chunk checksums not trustworthy
+
+  bool valid = true;
+
+  for (size_t chunk = page.findCorruptChunk(0); chunk < CHUNKS; chunk = page.findCorruptChunk(chunk + 1)) {
+    if (other.calculateChunkChecksum(chunk) == page.m_chunks[chunk]) {
+      size_t offset = chunk * CHUNK_SIZE;
+      size_t length = (offset + CHUNK_SIZE > sizeof(T)) ? sizeof(T) - offset : CHUNK_SIZE;
+      PRA_RETAINED_COPY((uint8_t*)&page.m_data + offset, (uint8_t*)&other.m_data + offset, length);
+      retlog().warn("Page %c chunk %u was corrupt, repaired from the other page", name, (unsigned)chunk);
+    }
+    else {
+      retlog().error("Page %c chunk %u is corrupt and cannot be repaired", name, (unsigned)chunk);
+      valid = false;
+    }
+  }
+
+  return valid;
+}
+
+
+/**
+ * Returns a reference to the scratchpad data object
+ *
+ * This object should be used to save data to the scratchpad object.
+ *
+ * @return A reference to scratchpad data object of template type &lt;T&gt;
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+T& ParticleRetainedAtomic<T, ChecksumPolicy, N>::getScratchpad() {
+  PRA_TRACE("ParticleRetainedAtomic getScratchpad");
+  if (m_syncPending) sync();
+  return *m_scratchData;
+}
+
+/**
+ * An alias for getScratchpad()
+ *
+ * This operator alias should allow the usage ParticleRetainedAtomicObject->templateTypeAccessor
+ * where templateTypeAccessor is a member of the templated class type.
+ *
+ * @note operator-> must return a void* type which allows it to be used by the
+ * caller in the expected way, although GCC seems to be aware of the type and
+ * can do static, compile time member checks on the T type object.
+ *
+ * After a lazy or deferred save(), this first completes sync(), since it cannot
+ * tell which member will be accessed. Otherwise it costs a test of that flag
+ * and a pointer load.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+T* ParticleRetainedAtomic<T, ChecksumPolicy, N>::operator->() {
+  PRA_TRACE("ParticleRetainedAtomic operator->");
+  if (m_syncPending) sync();
+  return m_scratchData;
+}
+
+/**
+ * Returns a read-only reference to the last saved data
+ *
+ * Unlike the scratchpad, this never shows changes that have not been saved
+ * yet, so readers get a consistent, committed state. There is no logging or
+ * bookkeeping: this is a single pointer load. operator-> also tests for an
+ * outstanding sync, and completes it first if there is one.
+ *
+ * @note The reference points to a different page after every save(), so do
+ * not hold on to it across a save().
+ *
+ * @return A const reference to the saved data object of template type &lt;T&gt;
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+const T& ParticleRetainedAtomic<T, ChecksumPolicy, N>::committed() const {
+  return *m_savedData.load(std::memory_order_relaxed);
+}
+
+/**
+ * An alias for committed()
+ *
+ * `float t = (*gAppState).lastReportTemperatureC;` reads the last saved
+ * value, while `gAppState->lastReportTemperatureC` reads the scratchpad.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+const T& ParticleRetainedAtomic<T, ChecksumPolicy, N>::operator*() const {
+  return *m_savedData.load(std::memory_order_relaxed);
+}
+
+/**
+ * Copies the last saved data, consistently, from any thread
+ *
+ * committed() returns a reference into a page that the next save() may start
+ * overwriting, so it is only safe on the thread that calls save(). This reads
+ * under a seqlock instead: the copy is retried if a save() swapped pages while
+ * it was being made, and waits (yielding) while a swap is in progress. The
+ * writer is never blocked, and any number of threads can read at once.
+ *
+ * All other methods must still be called from a single writer thread.
+ *
+ * @param copy Receives the last saved data
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::readCommitted(T& copy) const {
+  readVersion(copy);
+}
+
+/**
+ * Copies the last saved data like readCommitted()
+ * @param copy Receives the last saved data
+ * @return The seqlock count the copy was taken at, which changes on every commit
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+uint32_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::readVersion(T& copy) const {
+
+  uint32_t seq;
+
+  do {
+    while ((seq = m_readSeq.load(std::memory_order_acquire)) & 1) PRA_YIELD();
+
+    memcpy(&copy, m_savedData.load(std::memory_order_acquire), sizeof(T));   // acquire, like acquireSnapshot(), to see the page it points to
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while (m_readSeq.load(std::memory_order_relaxed) != seq);
+
+  return seq;
+}
+
+/**
+ * Starts an optimistic transaction, from any thread
+ *
+ * Returns a private working copy of the saved data. Threads that each update
+ * their own working copy cannot see or corrupt each other's changes, unlike
+ * threads sharing the scratchpad through operator->. WorkingCopy::commit()
+ * saves the copy only if nothing was committed since it was taken, and
+ * otherwise reports a conflict; the caller then starts over with a fresh
+ * working copy:
+ *
+ * `do { auto tx = gAppState.beginTransaction(); tx->reconnectCount++; } while (!tx.commit());`
+ *
+ * Commits are serialized by a spinlock, which save(), flush(), revert(),
+ * rollbackTo() and ParticleRetainedAtomicTransaction::commit() take as well,
+ * so the owner thread can keep calling those while
+ * other threads commit transactions. Only the bytes the working copy changed
+ * are written to the scratchpad; the owner's unsaved writes to other bytes
+ * stay there, and are committed along with the transaction, as is a save()
+ * still held back by setCommitWindow(). Do not mix transactions with writes
+ * through operator-> from other threads.
+ *
+ * @return Working copy of type WorkingCopy; it holds a full &lt;T&gt;
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+typename ParticleRetainedAtomic<T, ChecksumPolicy, N>::WorkingCopy ParticleRetainedAtomic<T, ChecksumPolicy, N>::beginTransaction(void) {
+  return WorkingCopy(this);
+}
+
+/**
+ * Saves a working copy if the saved data is still the version it was taken from
+ * @param data    Working copy
+ * @param version readVersion() result when the copy was taken
+ * @return true if saved, false on conflict or if ISRs kept saving
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::commitWorkingCopy(const T& data, uint32_t version) {
+
+  lockCommits();
+
+  bool current = (m_readSeq.load(std::memory_order_relaxed) == version);
+
+  if (current) {
+    const uint8_t* saved = (const uint8_t*)m_savedData.load(std::memory_order_relaxed);
+    const uint8_t* changed = (const uint8_t*)&data;
+
+    for (size_t block = 0; block < BLOCKS; block++) {
+      size_t offset = block * BLOCK_SIZE;
+      size_t length = (offset + BLOCK_SIZE > sizeof(T)) ? sizeof(T) - offset : BLOCK_SIZE;
+      if (memcmp(saved + offset, changed + offset, length) == 0) continue;
+
+      // only the bytes the transaction changed, so the owner's unsaved writes to the rest survive
+      markDirty(offset, length);
+      uint8_t* scratch = (uint8_t*)m_scratchData;
+      for (size_t i = offset; i < offset + length; i++) {
+        if (changed[i] != saved[i]) scratch[i] = changed[i];
+      }
+    }
+    // never coalesced, or a conflict could go unseen; ISRs saving throughout count as one
+    current = commit(m_lazySync ? Deferred : Immediate);
+  }
+  else {
+    PRA_TRACE("ParticleRetainedAtomic transaction conflict");
+  }
+
+  unlockCommits();
+  return current;
+}
+
+/**
+ * Takes the lock that serializes commits
+ *
+ * save(), flush(), revert(), rollbackTo(), commitISRSaves(), WorkingCopy
+ * commits from other threads and ParticleRetainedAtomicTransaction::commit()
+ * all swap or overwrite pages, so each holds this while it runs. commit() itself does not take it, so a locked method can call
+ * it. Yields while another thread holds the lock.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::lockCommits(void) {
+  bool unlocked = false;
+  while (!m_committing.compare_exchange_weak(unlocked, true, std::memory_order_acquire)) {
+    unlocked = false;
+    PRA_YIELD();
+  }
+}
+
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::unlockCommits(void) {
+  m_committing.store(false, std::memory_order_release);
+}
+
+/**
+ * Create a working copy of the owner's saved data
+ * @param owner Object the working copy belongs to
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::WorkingCopy::WorkingCopy(ParticleRetainedAtomic* owner) :
+                m_owner(owner) {
+  m_version = owner->readVersion(m_data);
+}
+
+template<typename T, typename ChecksumPolicy, size_t N> inline
+T& ParticleRetainedAtomic<T, ChecksumPolicy, N>::WorkingCopy::operator*() {
+  return m_data;
+}
+
+template<typename T, typename ChecksumPolicy, size_t N> inline
+T* ParticleRetainedAtomic<T, ChecksumPolicy, N>::WorkingCopy::operator->() {
+  return &m_data;
+}
+
+/**
+ * Saves the working copy, unless another commit happened since it was taken
+ *
+ * The working copy is single use: after a conflict, or after a successful
+ * commit, start a new one with beginTransaction().
+ *
+ * @return true if saved, false on conflict
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::WorkingCopy::commit() {
+  return m_owner->commitWorkingCopy(m_data, m_version);
+}
+
+/**
+ * Pins the last saved page for reading, from any thread
+ *
+ * Returns a guard that reads the saved page in place, without copying it.
+ * Until the guard is destroyed, save() will not reuse that page: the save()
+ * that would overwrite it waits (yielding) for the guard to be released.
+ * Acquiring and releasing take one atomic increment and decrement each, and
+ * any number of threads can hold snapshots at once.
+ *
+ * Keep snapshots short-lived. With two pages, the very next save() has to
+ * wait for the page. With a ring of N pages, a snapshot can be held across
+ * N - 2 saves. The writer thread must not hold a snapshot while it
+ * calls save(), or it will wait forever.
+ *
+ * `{ auto state = gAppState.acquireSnapshot(); publish(state->lastReportTemperatureC); }`
+ *
+ * @return Guard giving const access to the saved data
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+typename ParticleRetainedAtomic<T, ChecksumPolicy, N>::Snapshot ParticleRetainedAtomic<T, ChecksumPolicy, N>::acquireSnapshot(void) {
+
+  for (;;) {
+    const T* data = m_savedData.load(std::memory_order_seq_cst);
+    std::atomic<uint32_t>& readers = m_readers[pageIndex(data)];
+
+    readers.fetch_add(1, std::memory_order_seq_cst);
+    if (m_savedData.load(std::memory_order_seq_cst) == data) return Snapshot(data, &readers);
+    readers.fetch_sub(1, std::memory_order_release);      // saved page changed meanwhile, retry
+  }
+}
+
+/**
+ * Returns the index of the page holding the given data
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+size_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::pageIndex(const T* data) const {
+  size_t i = 0;
+  while (i < N - 1 && &m_pages[i].m_data != data) i++;
+  return i;
+}
+
+/**
+ * Create a snapshot guard; the caller has already counted it in readers
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::Snapshot::Snapshot(const T* data, std::atomic<uint32_t>* readers) :
+                m_data(data),
+                m_readers(readers) {
+}
+
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::Snapshot::Snapshot(Snapshot&& other) :
+                m_data(other.m_data),
+                m_readers(other.m_readers) {
+  other.m_readers = nullptr;
+}
+
+/**
+ * Releases the page, letting save() reuse it
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+ParticleRetainedAtomic<T, ChecksumPolicy, N>::Snapshot::~Snapshot() {
+  if (m_readers) m_readers->fetch_sub(1, std::memory_order_release);
+}
+
+template<typename T, typename ChecksumPolicy, size_t N> inline
+const T& ParticleRetainedAtomic<T, ChecksumPolicy, N>::Snapshot::operator*() const {
+  return *m_data;
+}
+
+template<typename T, typename ChecksumPolicy, size_t N> inline
+const T* ParticleRetainedAtomic<T, ChecksumPolicy, N>::Snapshot::operator->() const {
+  return m_data;
+}
+
+/**
+ * Returns the scratchpad data for use in interrupt context
+ *
+ * Unlike operator-> and getScratchpad(), this never completes an outstanding
+ * lazy sync, so it takes constant time. It also marks the object as written
+ * by ISRs, see setISRWrites(). Use it for every ISR write, e.g.
+ *
+ * `void onPulse() { gCounters.scratchpadFromISR()->pulses++; gCounters.saveFromISR(); }`
+ *
+ * @return A pointer to the scratchpad data object of template type &lt;T&gt;
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+T* ParticleRetainedAtomic<T, ChecksumPolicy, N>::scratchpadFromISR(void) {
+  static_assert(N >= 3, "saves from interrupt context need a ring of at least three pages");
+  m_isrWrites.store(true, std::memory_order_relaxed);
+  return m_scratchData;
+}
+
+/**
+ * Requests a save from interrupt context
+ *
+ * save() takes time proportional to sizeof(T) and must not run in an ISR.
+ * This only increments a counter inside a critical section of constant length.
+ * The ISR writes its changes through scratchpadFromISR(), and the copy,
+ * checksum and commit are done later, from thread context, by
+ * commitISRSaves() or save(). Until then a reset loses the change, like a
+ * change that was never saved.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::saveFromISR(void) {
+  static_assert(N >= 3, "saves from interrupt context need a ring of at least three pages");
+  PRA_ENTER_CRITICAL();
+  m_isrWrites.store(true, std::memory_order_relaxed);
+  m_isrEpoch.store(m_isrEpoch.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  PRA_EXIT_CRITICAL();
+}
+
+/**
+ * Declares that ISRs will write the scratchpad
+ *
+ * From then on every commit, including save() from thread context, copies
+ * and checksums the whole page and swaps the pages only if no ISR requested
+ * a save meanwhile, like commitISRSaves(). ISR writes are not dirty tracked,
+ * so the partial copies and incremental checksums of dirty tracking and lazy
+ * sync would miss them.
+ *
+ * scratchpadFromISR() and saveFromISR() do this too, but a save() already
+ * under way when the first interrupt arrives would not notice. Call this
+ * from setup(), before attaching the interrupt, if the thread also saves.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::setISRWrites(void) {
+  static_assert(N >= 3, "saves from interrupt context need a ring of at least three pages");
+  m_isrWrites.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * Commits the saves requested by saveFromISR(), from thread context
+ *
+ * Call it from the main loop or a worker thread. See commitAroundISRs() for
+ * how the commit avoids racing the ISR. save() commits the same way once ISRs
+ * write the scratchpad, so calling it instead also covers the ISR's changes.
+ *
+ * @return true if there was nothing to commit, or the commit succeeded
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::commitISRSaves(void) {
+
+  static_assert(N >= 3, "saves from interrupt context need a ring of at least three pages");
+
+  uint32_t requested = m_isrEpoch.load(std::memory_order_acquire);
+
+  lockCommits();
+  bool committed = (requested == m_isrCommitted) || commitAroundISRs(requested);
+  unlockCommits();
+  return committed;
+}
+
+/**
+ * Commits the scratchpad while ISRs may write it
+ *
+ * The scratchpad is copied to the next page and checksummed while interrupts
+ * stay enabled. Then, inside a critical section of constant length, the
+ * checksum is stored and the pages are swapped, but only if no ISR requested
+ * another save since the epoch given: such an ISR may have written to the
+ * scratchpad during the copy or checksum, and the call returns false so it
+ * can be retried. After the swap, ISR writes go to the next page, which
+ * already holds the same data.
+ *
+ * The copy has to go to a page other than the saved one before the commit
+ * point, so this needs a ring of at least three pages. It always copies and
+ * checksums the whole page, since ISR writes are not dirty tracked.
+ *
+ * @param requested  m_isrEpoch read before anything was copied
+ * @return true if the commit succeeded
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::commitAroundISRs(uint32_t requested) {
+
+  if (m_syncPending) sync();
+  SavePage<T>* next = nextPage(m_scratchpad);   // never the saved page, so readCommitted() is unaffected
+  while (m_readers[next - m_pages].load(std::memory_order_seq_cst)) PRA_YIELD();
+
+  next->clearChecksum();                // invalidate the next page before overwriting it
+  PRA_STORE_BARRIER();
+  *next = *m_scratchpad;
+
+  uint32_t checksum = m_scratchpad->calculateChecksum();
+  PRA_STORE_BARRIER();
+
+  uint32_t readSeq = m_readSeq.load(std::memory_order_relaxed);
+  m_readSeq.store(readSeq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  bool committed;
+  {
+    PRA_ENTER_CRITICAL();
+    committed = (m_isrEpoch.load(std::memory_order_relaxed) == requested);
+    if (committed) {
+      PRA_RETAINED_STORE(m_scratchpad->m_checksum, checksum);   // commit point
+      m_saved = m_scratchpad;
+      m_scratchpad = next;
+      m_scratchData = &next->m_data;
+      m_savedData.store(&m_saved->m_data, std::memory_order_seq_cst);
+    }
+    PRA_EXIT_CRITICAL();
+  }
+
+  if (committed) {
+    m_isrCommitted = requested;
+    m_derived = 0;                      // the whole page was checksummed and copied
+    markPagesStale();
+    if (m_tracking) m_tracking->dirty.clear();
+    clearSavepoints();
+    m_coalesced = 0;
+  }
+  else {
+    PRA_TRACE("ParticleRetainedAtomic ISR save raced with another, retry");
+  }
+
+  m_readSeq.store(readSeq + 2, std::memory_order_release);
+  return committed;
+}
+
+/**
+ * Returns the sequence number of the last saved data
+ *
+ * Record it to return to this generation later with rollbackTo().
+ *
+ * @return Sequence number, from 1 to UINT16_MAX
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+uint16_t ParticleRetainedAtomic<T, ChecksumPolicy, N>::savedSeqNum() const {
+  return m_saved->m_seqNum;
+}
+
+/**
+ * Discards all changes made to the scratchpad since the last save()
+ *
+ * Afterwards the scratchpad holds the saved data again, and saves held back
+ * by the commit window are discarded, so commitPending() returns false. With
+ * dirty tracking only the dirty blocks are copied back from the saved page;
+ * with lazy sync they are only marked for copying, like after a deferred
+ * save(). Without dirty tracking the whole page is copied.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::revert(void) {
+  PRA_TRACE("ParticleRetainedAtomic revert");
+
+  lockCommits();
+  if (!m_dirtyTracking) {
+    m_scratchpad->copyRange(*m_saved, 0, BLOCKS);
+    if (m_tracking) m_tracking->pending.clear();
+    m_syncPending = false;
+  }
+  else if (m_lazySync) {
+    m_tracking->pending.merge(m_tracking->dirty);
+    m_syncPending = true;
+  }
+  else {
+    size_t first = 0, end;
+    while (m_tracking->dirty.nextRun(first, end)) {
+      m_scratchpad->copyRange(*m_saved, first, end);
+      first = end;
+    }
+  }
+  if (m_tracking) m_tracking->dirty.clear();
+  clearSavepoints();
+  m_coalesced = 0;                      // the saves held back by the commit window are discarded too
+  unlockCommits();
+}
+
+/**
+ * Returns to an earlier saved generation
+ *
+ * Looks for a page other than the scratchpad that still holds the given
+ * sequence number and a valid checksum, copies its data to the scratchpad,
+ * and saves it. The rollback is therefore itself an atomic save with a new
+ * sequence number, and any changes in the scratchpad are discarded. With two
+ * pages only the last saved generation is available; a ring of N pages keeps
+ * the last N - 1.
+ *
+ * @param seqNum Sequence number of the generation, see savedSeqNum()
+ * @return true if the generation was found and restored; false as well if it
+ * was copied to the scratchpad but ISRs kept saving (see PRA_ISR_RETRIES)
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::rollbackTo(uint16_t seqNum) {
+
+  lockCommits();
+  for (size_t i = 0; i < N; i++) {
+    SavePage<T>& page = m_pages[i];
+    if (&page == m_scratchpad || page.m_seqNum != seqNum || !page.isValid()) continue;
+
+    PRA_TRACE("ParticleRetainedAtomic rollbackTo %u, page %c", seqNum, 'A' + (int)i);
+    m_scratchpad->copyRange(page, 0, BLOCKS);
+    m_syncPending = false;
+    if (m_tracking) {
+      m_tracking->pending.clear();      // every block was just overwritten
+      m_tracking->dirty.setAll();
+    }
+    bool committed = commit(m_lazySync ? Deferred : Immediate);
+    unlockCommits();
+    return committed;
+  }
+  unlockCommits();
+
+  retlog().warn("Cannot roll back to sequence number %u, no valid page holds it", seqNum);
+  return false;
+}
+
+/**
+ * Supplies the storage for savepoints
+ *
+ * The buffer holds the undo log and the block maps of the nested savepoints,
+ * so an object that never sets one carries neither. Each block of the
+ * scratchpad written after a savepoint is logged once per savepoint, so the
+ * buffer needs one entry per distinct BLOCK_SIZE block written. It is not
+ * retained and can be shared by instances that never have savepoints active
+ * at the same time:
+ *
+ * `static decltype(gAppState)::UndoBuffer<16> undo; gAppState.setUndoBuffer(&undo);`
+ *
+ * @param buffer  Undo buffer with Entries entries
+ */
+template<typename T, typename ChecksumPolicy, size_t N> template<size_t Entries> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::setUndoBuffer(UndoBuffer<Entries>* buffer) {
+  clearSavepoints();
+  m_savepointMaps = &buffer->savepoints;
+  m_undo = buffer->entries;
+  m_undoCapacity = Entries;
+}
+
+/**
+ * Withdraws the undo buffer, which drops any savepoints and disables them
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::setUndoBuffer(std::nullptr_t) {
+  clearSavepoints();
+  m_savepointMaps = nullptr;
+  m_undo = nullptr;
+  m_undoCapacity = 0;
+}
+
+/**
+ * Marks the current state of the scratchpad so it can be returned to
+ *
+ * Savepoints nest up to MAX_SAVEPOINTS deep and are dropped by save() and
+ * revert(). Dirty tracking and an undo buffer are required, and every write
+ * must be recorded before it is made: set() and modify() do this, while
+ * writes through operator-> need markDirty() *before* the write.
+ *
+ * @return true if the savepoint was set
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::savepoint(void) {
+
+  if (!m_dirtyTracking || m_undo == nullptr) {
+    retlog().warn("Savepoints need dirty tracking and an undo buffer");
+    return false;
+  }
+  if (m_savepoints == MAX_SAVEPOINTS) {
+    retlog().warn("Too many nested savepoints");
+    return false;
+  }
+
+  m_savepointMaps->start[m_savepoints] = m_undoLength;
+  m_savepointMaps->captured[m_savepoints].clear();
+  m_savepoints++;
+  return true;
+}
+
+/**
+ * Undoes every write made since the innermost savepoint, and drops it
+ *
+ * Only the logged blocks are copied back, newest first. The blocks stay
+ * marked dirty.
+ *
+ * @return false if there is no savepoint, or the undo buffer overflowed
+ * since it was set; the scratchpad is then left unchanged
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::rollbackToSavepoint(void) {
+
+  if (m_savepoints == 0) return false;
+  if (m_undoOverflow) {
+    retlog().error("Undo buffer overflowed, cannot roll back to savepoint");
+    return false;
+  }
+
+  size_t start = m_savepointMaps->start[--m_savepoints];
+
+  while (m_undoLength > start) {
+    const UndoEntry& entry = m_undo[--m_undoLength];
+    size_t offset = entry.block * BLOCK_SIZE;
+    size_t length = (offset + BLOCK_SIZE > sizeof(T)) ? sizeof(T) - offset : BLOCK_SIZE;
+    memcpy((uint8_t*)m_scratchData + offset, entry.data, length);
+  }
+  return true;
+}
+
+/**
+ * Drops the innermost savepoint and keeps the writes made since
+ *
+ * They can still be undone by rolling back to an enclosing savepoint.
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::releaseSavepoint(void) {
+
+  if (m_savepoints == 0) return;
+
+  m_savepoints--;
+  if (m_savepoints == 0) clearSavepoints();
+  else                   m_savepointMaps->captured[m_savepoints - 1].merge(m_savepointMaps->captured[m_savepoints]);
+}
+
+/**
+ * Logs blocks about to be written, for the innermost savepoint
+ *
+ * A block is logged only the first time it is written after the savepoint.
+ * An outer savepoint needs no entry of its own for a block first written
+ * inside an inner one: the inner entry holds the same data.
+ *
+ * @param first First block
+ * @param end   One past the last block
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::captureBlocks(size_t first, size_t end) {
+
+  BlockMap& captured = m_savepointMaps->captured[m_savepoints - 1];
+
+  if (end > BLOCKS) end = BLOCKS;
+  for (size_t block = first; block < end; block++) {
+    if (captured.test(block)) continue;
+    if (m_undoLength == m_undoCapacity) {
+      m_undoOverflow = true;
+      return;
+    }
+
+    UndoEntry& entry = m_undo[m_undoLength++];
+    size_t offset = block * BLOCK_SIZE;
+    size_t length = (offset + BLOCK_SIZE > sizeof(T)) ? sizeof(T) - offset : BLOCK_SIZE;
+    entry.block = block;
+    memcpy(entry.data, (const uint8_t*)m_scratchData + offset, length);
+    captured.set(block, block + 1);
+  }
+}
+
+/**
+ * Drops all savepoints and empties the undo log
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::clearSavepoints(void) {
+  m_savepoints = 0;
+  m_undoLength = 0;
+  m_undoOverflow = false;
+}
+
+/**
+ * Prepares the scratchpad for a transaction
+ *
+ * Like the first half of save(), but the checksum is stored XORed with the
+ * transaction's tag, so the page only counts as valid once the commit record
+ * says the transaction committed.
+ *
+ * @param tag  Transaction tag, see ParticleRetainedAtomicCommitRecord_t::tag()
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::prepare(uint32_t tag) {
+  if (m_syncPending) sync();
+  writeChecksum(tag);
+}
+
+/**
+ * Completes a transaction after its commit point
+ *
+ * Stores the plain checksum of the prepared scratchpad, then moves on to the
+ * next page like save().
+ *
+ * @param tag  Transaction tag passed to prepare()
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::finish(uint32_t tag) {
+  PRA_RETAINED_STORE(m_scratchpad->m_checksum, m_scratchpad->m_checksum ^ tag);
+  PRA_STORE_BARRIER();
+
+  swapPages(m_lazySync);
+  clearSavepoints();
+  m_coalesced = 0;
 }
 
 /**
@@ -320,18 +2729,560 @@ T* ParticleRetainedAtomic<T>::operator->() {
  *
  * This function saves the checksum of the current scratchpad page, copies
  * the former scratchpad contents to the other page, and invalidates its checksum.
+ * With dirty tracking enabled only the blocks written since the last save()
+ * are copied, and the checksum is updated from the saved page's checksum when
+ * the checksum policy supports it.
  *
  * The pointers to save and scratch are now swapped and all modifications occur
  * in the new scratchpad area.
+ *
+ * With lazy sync enabled, this is save(Deferred).
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::save(void) {
+  save(m_lazySync ? Deferred : Immediate);
+}
+
+/**
+ * Atomically saves the scratchpad data, optionally deferring the page copy
+ *
+ * With Deferred, nothing is copied to the other page here. Only the checksum
+ * and sequence number are written and the pages swapped, so the time spent
+ * does not depend on the copy. The blocks the new scratchpad lacks are copied
+ * by sync(), or when they are first written through set(), modify() or
+ * markDirty(). Without dirty tracking that is every block. operator-> and
+ * getScratchpad() complete the sync before returning.
+ *
+ * Any sync still outstanding when save() is called is completed first, since
+ * the page being committed must hold every block.
+ *
+ * With a commit window set, the commit only happens once the window has
+ * passed; otherwise this call is coalesced into a later commit or flush().
+ *
+ * Once ISRs write the scratchpad, the commit is retried while they keep
+ * saving, up to PRA_ISR_RETRIES times. If every attempt is overtaken, it is
+ * left pending like a coalesced save: commitPending() returns true, and
+ * flush() or the next save() tries again.
+ *
+ * @param mode Immediate or Deferred
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::save(SaveMode mode) {
+  PRA_TRACE("ParticleRetainedAtomic save");
+
+  lockCommits();
+  bool due = true;
+  if (m_commitWindowMs || m_commitWindowCalls) {
+    due = (m_commitWindowCalls && m_coalesced + 1 >= m_commitWindowCalls) ||
+          (m_commitWindowMs && millis() - m_lastCommit >= m_commitWindowMs);
+  }
+
+  if (due) {
+    commit(mode);
+  }
+  else {
+    m_coalesced++;
+    clearSavepoints();
+  }
+  unlockCommits();
+}
+
+/**
+ * Sets a commit window to coalesce save() calls
+ *
+ * For code that calls save() after every small update while durability only
+ * matters at a coarser granularity. save() then commits only if ms
+ * milliseconds have passed since the last commit, or if it is the calls-th
+ * call since then; other calls return right away and their changes are
+ * included in the next commit. Either limit can be 0 to disable it, and both
+ * 0 (the default) commits on every save().
+ *
+ * Changes from a coalesced save() are lost if the device resets before the
+ * next commit. Call flush() where they must be durable, e.g. before sleep or
+ * from the main loop. revert() and rollbackTo() work from the last actual
+ * commit, so they also discard coalesced saves.
+ *
+ * @param ms     Minimum time between commits, in milliseconds
+ * @param calls  Maximum number of save() calls per commit
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::setCommitWindow(uint32_t ms, uint32_t calls) {
+  m_commitWindowMs = ms;
+  m_commitWindowCalls = calls;
+  m_lastCommit = millis();
+}
+
+/**
+ * Commits the saves held back by the commit window, if any
+ *
+ * Also retries a save() that ISRs kept overtaking, see save().
+ *
+ * @return true if a commit was made
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::flush(void) {
+  lockCommits();
+  bool committed = (m_coalesced != 0) && commit(m_lazySync ? Deferred : Immediate);
+  unlockCommits();
+  return committed;
+}
+
+/**
+ * @return true if a save() has been coalesced and not yet committed
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::commitPending(void) const {
+  return m_coalesced != 0;
+}
+
+/**
+ * Commits the scratchpad, as save() does outside a commit window
+ * @param mode Immediate or Deferred
+ * @return true, unless ISRs saved during each of PRA_ISR_RETRIES attempts;
+ * the save is then left pending
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::commit(SaveMode mode) {
+
+  if (N >= 3 && m_isrWrites.load(std::memory_order_relaxed)) {
+    // the ISR may write at any time, and its writes are not in the dirty map
+    int attempts = 0;
+    while (!commitAroundISRs(m_isrEpoch.load(std::memory_order_acquire))) {
+      if (++attempts == PRA_ISR_RETRIES) {
+        retlog().warn("ISRs saved during %d commit attempts, save left pending", attempts);
+        m_coalesced++;
+        return false;
+      }
+      PRA_YIELD();
+    }
+  }
+  else {
+    if (m_syncPending) sync();          // blocks never written since the last deferred save()
+
+    // write valid checksum to scratchpad-- this data is now safely stored
+    writeChecksum(0);
+
+    PRA_STORE_BARRIER();                // commit point: the old page may only be touched after this
+
+    swapPages(mode == Deferred);
+    clearSavepoints();
+  }
+
+  m_coalesced = 0;
+  if (m_commitWindowMs) m_lastCommit = millis();
+  return true;
+}
+
+/**
+ * Writes the checksum of the scratchpad
+ *
+ * With dirty tracking it is derived from the saved page's checksum and the
+ * dirty blocks. A write that was not recorded is then missing from the
+ * checksum, and from the pages the dirty blocks are copied to, so the pages
+ * disagree and checksums derived from one another keep coming out wrong.
+ * Every PRA_CHECKSUM_ANCHOR-th commit therefore marks the whole page dirty:
+ * it is checksummed in full and copied in full to every other page, which
+ * brings them all back in line with the data.
+ *
+ * @param tag  Transaction tag, see SavePage::writeChecksum(uint32_t)
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::writeChecksum(uint32_t tag) {
+  if (!m_dirtyTracking) {
+    m_scratchpad->writeChecksum(tag);
+    return;
+  }
+
+  if (PRA_CHECKSUM_ANCHOR != 0 && ++m_derived == PRA_CHECKSUM_ANCHOR) {
+    m_tracking->dirty.setAll();
+    m_derived = 0;
+  }
+  m_scratchpad->writeChecksum(*m_saved, m_tracking->dirty, tag);
+}
+
+/**
+ * Copies the scratchpad to the next page and makes that the new scratchpad
+ *
+ * The scratchpad must already hold a valid checksum. Afterwards it is the
+ * saved page, and the page after it in the ring, with an invalidated checksum,
+ * is the new scratchpad. With two pages that is the previously saved page.
+ *
+ * The next page is invalidated before it is overwritten. A chunked page's
+ * root checksum only covers the chunk checksums, so otherwise a reset during
+ * the copy would leave a page with a valid root and half-copied chunk data.
+ *
+ * With dirty tracking, only the blocks written since the next page was last
+ * brought up to date are copied. With two pages those are the blocks written
+ * since the last save(); with more, the writes of every save() since the
+ * ring last came round to that page.
+ *
+ * @param deferred  Record the blocks the new scratchpad lacks in the pending
+ *                  map instead of copying them; ignored without a tracking
+ *                  buffer to record them in
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::swapPages(bool deferred) {
+
+  SavePage<T>* next = nextPage(m_scratchpad);
+  TrackingBuffer* tracking = m_tracking;
+  if (tracking == nullptr) deferred = false;
+
+  m_savedData.store(&m_scratchpad->m_data, std::memory_order_seq_cst);
+
+  // wait for snapshots of the next page to be released; new ones can no longer pin it
+  while (m_readers[next - m_pages].load(std::memory_order_seq_cst)) PRA_YIELD();
+
+  // readers that may still be copying the next page retry once it is stable again
+  uint32_t readSeq = m_readSeq.load(std::memory_order_relaxed);
+  m_readSeq.store(readSeq + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  next->clearChecksum();                // invalidate the next page before overwriting it
+  PRA_STORE_BARRIER();
+
+  if (m_dirtyTracking) {
+    for (size_t i = 0; i < N; i++) {
+      if (&m_pages[i] != m_scratchpad) tracking->stale[i].merge(tracking->dirty);
+    }
+  }
+
+  // copy most current data from scratchpad to the next page
+  if (deferred) {
+    next->copyBlocks(*m_scratchpad, BlockMap());      // sequence number and chunk table only
+    if (m_dirtyTracking) tracking->pending = tracking->stale[next - m_pages];
+    else                 tracking->pending.setAll();
+    m_syncPending = true;
+  }
+  else if (m_dirtyTracking) next->copyBlocks(*m_scratchpad, tracking->stale[next - m_pages]);
+  else                      *next = *m_scratchpad;
+  if (tracking) {
+    tracking->stale[next - m_pages].clear();
+    tracking->dirty.clear();
+  }
+
+  m_saved = m_scratchpad;               // the scratchpad is now saved, and the next page is scratch
+  m_scratchpad = next;
+  m_scratchData = &next->m_data;
+
+  m_readSeq.store(readSeq + 2, std::memory_order_release);
+}
+
+/**
+ * Supplies the storage for dirty tracking and lazy sync
+ *
+ * The buffer holds a map of BLOCK_SIZE blocks for the dirty blocks, for the
+ * blocks a deferred save() left to copy, and for each page's stale blocks, so
+ * an object that never uses them carries none of it. It is not retained, and
+ * each instance needs its own:
+ *
+ * `static decltype(gAppState)::TrackingBuffer tracking; gAppState.setTrackingBuffer(&tracking);`
+ *
+ * Dirty tracking and lazy sync are disabled first; enable them again after
+ * supplying the new buffer. Without one, save(Deferred) copies right away.
+ *
+ * @param buffer  Tracking buffer, or nullptr to withdraw it
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::setTrackingBuffer(TrackingBuffer* buffer) {
+  setDirtyTracking(false);
+  if (m_syncPending) sync();            // a save(Deferred) may have left blocks to copy
+  m_tracking = buffer;
+  if (buffer) buffer->pending.clear();
+}
+
+/**
+ * Enables or disables dirty tracking
+ *
+ * With dirty tracking enabled, save() copies only the blocks recorded by
+ * set(), modify() and markDirty() instead of all of &lt;T&gt;. Every write to
+ * the scratchpad must then be recorded, including writes made through
+ * operator->, or it will be missing from the page that becomes the next
+ * scratchpad.
+ *
+ * Enabling marks the whole scratchpad dirty and every other page stale, since
+ * earlier writes were not recorded, so the first save() afterwards still
+ * checksums and copies everything, and each other page of a ring is copied in
+ * full when its turn comes. revert() does not undo the latter.
+ *
+ * Dirty tracking needs a buffer supplied by setTrackingBuffer(); without one
+ * it stays disabled.
+ *
+ * @param enable true to copy only dirty blocks on save()
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::setDirtyTracking(bool enable) {
+  if (enable && m_tracking == nullptr) {
+    retlog().warn("Dirty tracking needs a tracking buffer, see setTrackingBuffer()");
+    return;
+  }
+  if (!enable) setLazySync(false);
+  if (!enable) clearSavepoints();
+  if (enable && !m_dirtyTracking) {
+    m_tracking->dirty.setAll();
+    markPagesStale();
+  }
+  m_dirtyTracking = enable;
+}
+
+/**
+ * Enables or disables lazy sync
+ *
+ * Normally save() copies the new saved page to the other page, which becomes
+ * the next scratchpad. With lazy sync enabled, save() only writes the checksum,
+ * invalidates the other page and swaps the two; the saved page is simply the
+ * one with a valid checksum and the newest sequence number. The blocks the new
+ * scratchpad is missing are recorded, and each is copied from the saved page
+ * when set(), modify() or markDirty() first touches it. Any left over are
+ * copied by the next save(), or all at once by operator-> or getScratchpad().
+ * A burst of saves with few writes in between then costs little more than
+ * the checksums.
+ *
+ * Lazy sync implies dirty tracking, which is enabled along with it, and every
+ * write must be recorded the same way; it needs a buffer supplied by
+ * setTrackingBuffer() too. Disabling lazy sync copies the outstanding blocks
+ * right away.
+ *
+ * @param enable true to defer the page copy until blocks are written
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::setLazySync(bool enable) {
+  if (enable) setDirtyTracking(true);
+  else if (m_syncPending) sync();
+  m_lazySync = enable && m_dirtyTracking;
+}
+
+/**
+ * Brings the scratchpad up to date after a deferred save()
+ *
+ * Copies at most maxBytes, rounded up to whole blocks, of the data the
+ * scratchpad still lacks from the saved page, and at least one block. Call it
+ * from an idle loop, e.g. `while (!gAppState.sync(512)) yieldToControlLoop();`,
+ * to spread the copy over several calls of bounded duration.
+ *
+ * @param maxBytes Upper bound on the bytes copied by this call
+ * @return true if the scratchpad is up to date
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+bool ParticleRetainedAtomic<T, ChecksumPolicy, N>::sync(size_t maxBytes) {
+
+  if (!m_syncPending) return true;
+
+  size_t budget = maxBytes / BLOCK_SIZE + (maxBytes % BLOCK_SIZE != 0);   // rounded up, without overflow
+  if (budget == 0) budget = 1;
+  size_t first = 0, end;
+
+  BlockMap& pending = m_tracking->pending;
+
+  while (budget > 0 && pending.nextRun(first, end)) {
+    if (end - first > budget) end = first + budget;
+    m_scratchpad->copyRange(*m_saved, first, end);
+    pending.reset(first, end);
+    budget -= end - first;
+    first = end;
+  }
+
+  if (!pending.any()) m_syncPending = false;
+  return !m_syncPending;
+}
+
+/**
+ * Copies the pending blocks in a range from the saved page to the scratchpad
+ * @param first First block to sync
+ * @param end   One past the last block to sync
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::syncBlocks(size_t first, size_t end) {
+
+  BlockMap& pending = m_tracking->pending;
+  size_t runEnd;
+
+  while (first < end && pending.nextRun(first, runEnd) && first < end) {
+    if (runEnd > end) runEnd = end;
+    m_scratchpad->copyRange(*m_saved, first, runEnd);
+    pending.reset(first, runEnd);
+    first = runEnd;
+  }
+}
+
+/**
+ * Records a write to a byte range of the scratchpad
+ *
+ * Use this for writes made through operator-> while dirty tracking is enabled,
+ * e.g. `gAppState.markDirty(offsetof(State, counters), sizeof(State::counters));`
+ *
+ * After a lazy or deferred save(), the range is first brought up to date from
+ * the saved page, so a write through a pointer kept from before the last
+ * save() must come after this call, not before it.
+ *
+ * @param offset Offset of the first byte written, from the start of &lt;T&gt;
+ * @param length Number of bytes written
+ */
+template<typename T, typename ChecksumPolicy, size_t N> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::markDirty(size_t offset, size_t length) {
+  if (length == 0 || offset >= sizeof(T)) return;
+
+  size_t first = offset / BLOCK_SIZE;
+  size_t end = (offset + length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+
+  if (m_syncPending)   syncBlocks(first, end);   // copy on first write
+  if (m_savepoints)    captureBlocks(first, end);
+  if (m_dirtyTracking) m_tracking->dirty.set(first, end);
+}
+
+/**
+ * Marks a member of the scratchpad dirty and returns a reference to it
+ *
+ * `gAppState.modify(&State::reconnectCount)++;`
+ *
+ * @param member Pointer to a member of &lt;T&gt;
+ * @return Reference to that member in the scratchpad
+ */
+template<typename T, typename ChecksumPolicy, size_t N> template<typename M> inline
+M& ParticleRetainedAtomic<T, ChecksumPolicy, N>::modify(M T::*member) {
+  M& field = m_scratchData->*member;
+  markDirty((uint8_t*)&field - (uint8_t*)m_scratchData, sizeof(M));
+  return field;
+}
+
+/**
+ * Writes a member of the scratchpad and marks it dirty
+ *
+ * `gAppState.set(&State::lastReportTime, Time.now());`
+ *
+ * @param member Pointer to a member of &lt;T&gt;
+ * @param value  New value of the member
+ */
+template<typename T, typename ChecksumPolicy, size_t N> template<typename M> inline
+void ParticleRetainedAtomic<T, ChecksumPolicy, N>::set(M T::*member, const M& value) {
+  modify(member) = value;
+}
+
+
+/**
+ * Commits several ParticleRetainedAtomic objects together
+ *
+ * Each object's save() is atomic on its own. A transaction makes the changes
+ * of several objects atomic as a group, with a single commit point:
+ *
+ * `ParticleRetainedAtomicTransaction tx(gCommitRecord); tx.commit(gNetwork, gSensors, gBilling);`
+ *
+ * commit() first hands out a new transaction number, then prepares every
+ * object: its scratchpad checksum is written XORed with a tag derived from
+ * the transaction number, so none of the new pages is valid yet. Storing the
+ * transaction number to committedTxn in the retained commit record is the
+ * commit point. Each object then completes its checksum and moves on to its
+ * next page, like save().
+ *
+ * A reset before the commit point leaves every object at its previous save.
+ * A reset after it is rolled forward by the constructors taking the commit
+ * record, which every participating object must use.
+ */
+class ParticleRetainedAtomicTransaction {
+
+private:
+  ParticleRetainedAtomicCommitRecord_t& m_record;
+
+  struct Participant {                  // type erased, so participants of any type can be sorted
+    void* object;
+    void (*lock)(void* object);
+    void (*unlock)(void* object);
+  };
+  template<typename P> static void lockParticipant(void* object);
+  template<typename P> static void unlockParticipant(void* object);
+  static void lockAll(Participant* participants, size_t count);
+  static void unlockAll(Participant* participants, size_t count);
+
+public:
+  ParticleRetainedAtomicTransaction(ParticleRetainedAtomicCommitRecord_t& commitRecord);
+
+  template<typename... Participants>
+  void commit(Participants&... participants);   // saves all participants atomically
+
+};
+
+/**
+ * Create a transaction coordinator
+ * @param commitRecord  Reference to a retained ParticleRetainedAtomicCommitRecord_t
+ */
+inline ParticleRetainedAtomicTransaction::ParticleRetainedAtomicTransaction(ParticleRetainedAtomicCommitRecord_t& commitRecord) :
+                m_record(commitRecord) {
+}
+
+template<typename P> inline
+void ParticleRetainedAtomicTransaction::lockParticipant(void* object) {
+  static_cast<P*>(object)->lockCommits();
+}
+
+template<typename P> inline
+void ParticleRetainedAtomicTransaction::unlockParticipant(void* object) {
+  static_cast<P*>(object)->unlockCommits();
+}
+
+/**
+ * Takes the commit lock of every participant, in address order
+ *
+ * Two transactions sharing participants always lock them in the same order,
+ * so they cannot deadlock. A participant listed twice is locked once.
+ *
+ * @param participants  Participants, sorted in place
+ * @param count         Number of participants
+ */
+inline void ParticleRetainedAtomicTransaction::lockAll(Participant* participants, size_t count) {
+  for (size_t i = 1; i < count; i++) {
+    for (size_t j = i; j > 0 && participants[j].object < participants[j-1].object; j--) {
+      Participant swapped = participants[j];
+      participants[j] = participants[j-1];
+      participants[j-1] = swapped;
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (i == 0 || participants[i].object != participants[i-1].object) participants[i].lock(participants[i].object);
+  }
+}
+
+/**
+ * Releases the locks taken by lockAll(), in reverse order
+ * @param participants  Participants, as sorted by lockAll()
+ * @param count         Number of participants
+ */
+inline void ParticleRetainedAtomicTransaction::unlockAll(Participant* participants, size_t count) {
+  for (size_t i = count; i-- > 0;) {
+    if (i == 0 || participants[i].object != participants[i-1].object) participants[i].unlock(participants[i].object);
+  }
+}
+
+/**
+ * Saves the scratchpads of all participants as one atomic step
+ *
+ * Holds the commit lock of every participant (see
+ * ParticleRetainedAtomic::lockCommits()) from before the first prepare until
+ * the last participant has moved on to its next page.
+ *
+ * @param participants  ParticleRetainedAtomic objects constructed with the same commit record
  */
-template<typename T> inline
-void ParticleRetainedAtomic<T>::save(void) {
-  retlog.trace("ParticleRetainedAtomic save");
-  m_scratchpad->writeChecksum();        // write valid checksum to scratchpad-- this data is now safely stored
-  *m_saved = *m_scratchpad;             // copy most current data from scrtatchpad to (previously) saved page
-  m_saved->clearChecksum();             // invalidate (previously) saved page
+template<typename... Participants> inline
+void ParticleRetainedAtomicTransaction::commit(Participants&... participants) {
+
+  Participant locks[] = { { &participants, &lockParticipant<Participants>, &unlockParticipant<Participants> }... };
+  lockAll(locks, sizeof...(participants));
+
+  uint32_t txn = m_record.nextTxn + 1;
+  if (txn == 0) txn = 1;                // zero means no transaction has committed
+  PRA_RETAINED_STORE(m_record.nextTxn, txn);
+  PRA_STORE_BARRIER();
+
+  uint32_t tag = ParticleRetainedAtomicCommitRecord_t::tag(txn);
+  PRA_TRACE("ParticleRetainedAtomicTransaction commit %lu", (unsigned long)txn);
+
+  int prepared[] = { 0, (participants.prepare(tag), 0)... };
+  (void)prepared;
+  PRA_STORE_BARRIER();
+
+  PRA_RETAINED_STORE(m_record.committedTxn, txn);   // commit point
+  PRA_STORE_BARRIER();
+
+  int finished[] = { 0, (participants.finish(tag), 0)... };
+  (void)finished;
 
-  SavePage<T>* a = m_saved;             // now swap pointers so that saved becomes scratch and vice versa
-  m_saved = m_scratchpad;
-  m_scratchpad = a;
+  unlockAll(locks, sizeof...(participants));
 }
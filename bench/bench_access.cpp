@@ -0,0 +1,63 @@
+/**
+ * Cost of field access through the library, against a raw pointer
+ *
+ * Memory is clobbered every iteration, so each access reloads everything it
+ * depends on, as in a sensor loop that calls other code between accesses.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t samples;
+  float lastReading;
+  uint8_t log[1000];
+};
+
+State pageA, pageB, defaults;
+ParticleRetainedAtomicData_t data;
+ParticleRetainedAtomic<State> gAppState(pageA, pageB, data, defaults);
+
+void BM_RawPointer(benchmark::State& bench) {
+  State* state = &pageA;
+  benchmark::DoNotOptimize(state);
+  for (auto _ : bench) {
+    state->samples++;
+    benchmark::ClobberMemory();
+  }
+}
+
+void BM_Arrow(benchmark::State& bench) {
+  for (auto _ : bench) {
+    gAppState->samples++;
+    benchmark::ClobberMemory();
+  }
+}
+
+void BM_Modify(benchmark::State& bench) {
+  static decltype(gAppState)::TrackingBuffer tracking;
+  gAppState.setTrackingBuffer(&tracking);
+  gAppState.setDirtyTracking(true);
+  for (auto _ : bench) {
+    gAppState.modify(&State::samples)++;
+    benchmark::ClobberMemory();
+  }
+  gAppState.setDirtyTracking(false);
+}
+
+void BM_Committed(benchmark::State& bench) {
+  for (auto _ : bench) {
+    benchmark::DoNotOptimize(gAppState.committed().lastReading);
+    benchmark::ClobberMemory();
+  }
+}
+
+}
+
+BENCHMARK(BM_RawPointer);
+BENCHMARK(BM_Arrow);
+BENCHMARK(BM_Modify);
+BENCHMARK(BM_Committed);
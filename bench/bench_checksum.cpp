@@ -0,0 +1,55 @@
+/**
+ * Checksum throughput of each policy, against the byte loop the library
+ * originally used, over page sizes of 64 B, 1 KB and 16 KB
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+// SavePage::calculateChecksum() before checksum policies existed
+uint32_t originalLoop(const void* data, size_t length, uint16_t seqNum) {
+  uint32_t sum = 0;
+  const uint8_t* p = (const uint8_t*)data;
+  const uint8_t* pEnd = p + length;
+
+  do {
+    sum += *(p++);
+    benchmark::ClobberMemory();           // keep the compiler from vectorizing it, as the device compiler does not
+  } while (p < pEnd);
+
+  sum += (0xff00 & seqNum) >> 8;
+  sum += seqNum & 0xff;
+  return ~sum;
+}
+
+struct OriginalLoop {
+  static uint32_t calculate(const void* data, size_t length, uint16_t seqNum) { return originalLoop(data, length, seqNum); }
+};
+
+template<typename Policy>
+void BM_Checksum(benchmark::State& bench) {
+  std::vector<uint8_t> page(bench.range(0));
+  for (size_t i = 0; i < page.size(); i++) page[i] = (uint8_t)(i * 31);
+
+  for (auto _ : bench) {
+    benchmark::DoNotOptimize(Policy::calculate(page.data(), page.size(), (uint16_t)1));
+  }
+  bench.SetBytesProcessed(bench.iterations() * page.size());
+}
+
+}
+
+#define PRA_CHECKSUM_BENCHMARK(Policy) BENCHMARK_TEMPLATE(BM_Checksum, Policy)->Arg(64)->Arg(1024)->Arg(16384)
+
+PRA_CHECKSUM_BENCHMARK(OriginalLoop);
+PRA_CHECKSUM_BENCHMARK(ParticleRetainedAtomicByteSum);
+PRA_CHECKSUM_BENCHMARK(ParticleRetainedAtomicFletcher32);
+PRA_CHECKSUM_BENCHMARK(ParticleRetainedAtomicAdler32);
+PRA_CHECKSUM_BENCHMARK(ParticleRetainedAtomicXxHash32);
+PRA_CHECKSUM_BENCHMARK(ParticleRetainedAtomicCrc32C);
+PRA_CHECKSUM_BENCHMARK(ParticleRetainedAtomicCrc32);
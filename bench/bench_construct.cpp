@@ -0,0 +1,91 @@
+/**
+ * Constructor recovery time in each branch, from 8 B to 64 KB, and the
+ * number of passes over the page data
+ *
+ * The retained pages are reset to the branch's starting state before every
+ * construction, outside the timed region.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include <chrono>
+
+#include "counting_policy.h"
+#include "bench_sizes.h"
+
+size_t CountingPolicy::s_bytes = 0;
+
+namespace {
+
+enum Branch {
+  AValid,
+  BValid,
+  BothValid,
+  NeitherValid
+};
+
+template<size_t Size>
+struct Retained {
+  SizedState<Size> a, b;
+  ParticleRetainedAtomicData_t data;
+};
+
+template<size_t Size>
+void setPage(SizedState<Size>& page, uint16_t& seqNum, uint32_t& checksum, uint8_t fill, uint16_t seq, bool valid) {
+  memset(&page, fill, sizeof(page));
+  seqNum = seq;
+  checksum = ParticleRetainedAtomicCrc32C::calculate(&page, Size, seq);
+  if (!valid) checksum = ~checksum;
+}
+
+template<size_t Size>
+void prepare(Retained<Size>& mem, Branch branch) {
+  setPage(mem.a, mem.data.seqNumA, mem.data.checksumA, 0xA5, 10, branch == AValid || branch == BothValid);
+  setPage(mem.b, mem.data.seqNumB, mem.data.checksumB, 0x5A, 11, branch == BValid || branch == BothValid);
+}
+
+template<size_t Size, Branch B>
+void BM_Construct(benchmark::State& bench) {
+  static Retained<Size> mem, initial;
+  static SizedState<Size> defaults;
+  prepare(initial, B);
+
+  for (auto _ : bench) {
+    mem = initial;
+    auto start = std::chrono::steady_clock::now();
+    ParticleRetainedAtomic<SizedState<Size>> state(mem.a, mem.b, mem.data, defaults);
+    auto end = std::chrono::steady_clock::now();
+
+    benchmark::DoNotOptimize(&state);
+    bench.SetIterationTime(std::chrono::duration<double>(end - start).count());
+  }
+  bench.SetBytesProcessed(bench.iterations() * Size);
+}
+
+// passes: full checksum passes per construction; 2 with a valid page, 3 without
+void BM_ConstructPasses(benchmark::State& bench) {
+  static SizedState<8192> pageA, pageB, defaults;
+  static ParticleRetainedAtomicData_t data;
+  { ParticleRetainedAtomic<SizedState<8192>, CountingPolicy> init(pageA, pageB, data, defaults); }
+
+  CountingPolicy::reset();
+  for (auto _ : bench) {
+    ParticleRetainedAtomic<SizedState<8192>, CountingPolicy> state(pageA, pageB, data, defaults);
+    benchmark::DoNotOptimize(&state);
+  }
+
+  double passes = (double)CountingPolicy::s_bytes / sizeof(pageA) / bench.iterations();
+  bench.counters["passes"] = passes;
+  if (passes != 2) bench.SkipWithError("construction should hash each page exactly once");
+}
+
+}
+
+#define PRA_CONSTRUCT_BENCHMARKS(Size)                                  \
+  BENCHMARK_TEMPLATE(BM_Construct, Size, AValid)->UseManualTime();      \
+  BENCHMARK_TEMPLATE(BM_Construct, Size, BValid)->UseManualTime();      \
+  BENCHMARK_TEMPLATE(BM_Construct, Size, BothValid)->UseManualTime();   \
+  BENCHMARK_TEMPLATE(BM_Construct, Size, NeitherValid)->UseManualTime();
+
+PRA_FOR_EACH_SIZE(PRA_CONSTRUCT_BENCHMARKS)
+BENCHMARK(BM_ConstructPasses);
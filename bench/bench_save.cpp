@@ -0,0 +1,61 @@
+/**
+ * save() latency, from 8 B to 64 KB
+ *
+ * bytes_per_second counts sizeof(T) per save(), also for the dirty tracking
+ * variant that only copies the one block written.
+ */
+
+#include <benchmark/benchmark.h>
+
+#include "ParticleRetainedAtomic.h"
+#include "bench_sizes.h"
+
+namespace {
+
+template<size_t Size>
+struct Pages {
+  static SizedState<Size> a, b, defaults;
+  static ParticleRetainedAtomicData_t data;
+};
+
+template<size_t Size> SizedState<Size> Pages<Size>::a;
+template<size_t Size> SizedState<Size> Pages<Size>::b;
+template<size_t Size> SizedState<Size> Pages<Size>::defaults;
+template<size_t Size> ParticleRetainedAtomicData_t Pages<Size>::data;
+
+template<size_t Size>
+void BM_Save(benchmark::State& bench) {
+  typedef Pages<Size> P;
+  ParticleRetainedAtomic<SizedState<Size>> state(P::a, P::b, P::data, P::defaults);
+
+  for (auto _ : bench) {
+    state->bytes[0]++;
+    state.save();
+  }
+  bench.SetBytesProcessed(bench.iterations() * Size);
+}
+
+template<size_t Size>
+void BM_SaveDirtyTracking(benchmark::State& bench) {
+  typedef Pages<Size> P;
+  typename ParticleRetainedAtomic<SizedState<Size>>::TrackingBuffer tracking;
+  ParticleRetainedAtomic<SizedState<Size>> state(P::a, P::b, P::data, P::defaults);
+  state.setTrackingBuffer(&tracking);
+  state.setDirtyTracking(true);
+  state.save();
+
+  for (auto _ : bench) {
+    state.markDirty(Size / 2, 1);
+    state->bytes[Size / 2]++;
+    state.save();
+  }
+  bench.SetBytesProcessed(bench.iterations() * Size);
+}
+
+}
+
+#define PRA_SAVE_BENCHMARKS(Size)                 \
+  BENCHMARK_TEMPLATE(BM_Save, Size);              \
+  BENCHMARK_TEMPLATE(BM_SaveDirtyTracking, Size);
+
+PRA_FOR_EACH_SIZE(PRA_SAVE_BENCHMARKS)
@@ -0,0 +1,19 @@
+/**
+ * State types of the sizes the benchmarks are run at, from 8 B to 64 KB
+ */
+
+#ifndef PRA_BENCH_SIZES_H
+#define PRA_BENCH_SIZES_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+template<size_t Size>
+struct SizedState {
+  uint8_t bytes[Size];
+};
+
+// Expands M(Size) once per state size
+#define PRA_FOR_EACH_SIZE(M) M(8) M(64) M(512) M(4096) M(16384) M(65536)
+
+#endif
@@ -0,0 +1,68 @@
+/** @file Particle.h
+ *  @brief Host stand-in for the parts of Particle.h used by ParticleRetainedAtomic
+ *
+ *  Put this directory on the include path of host builds (simulators,
+ *  benchmarks, tests on Linux or macOS) in place of the Device OS headers.
+ *  Projects that already have their own Particle.h mock can use that instead;
+ *  it needs to provide what is defined here.
+ *
+ *  @license   MIT
+ */
+
+#ifndef PRA_HOST_PARTICLE_H
+#define PRA_HOST_PARTICLE_H
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+// host RAM is never retained; this only keeps declarations compiling
+#define retained
+
+/**
+ * A Logger that writes every message to stderr
+ */
+class Logger {
+
+private:
+  const char* m_name;
+  void log(const char* level, const char* fmt, va_list args) const {
+    fprintf(stderr, "[%s] %s: ", m_name, level);
+    vfprintf(stderr, fmt, args);
+    fputc('\n', stderr);
+  }
+
+public:
+  explicit Logger(const char* name) : m_name(name) {}
+  void trace(const char* fmt, ...) const { va_list a; va_start(a, fmt); log("TRACE", fmt, a); va_end(a); }
+  void info(const char* fmt, ...) const  { va_list a; va_start(a, fmt); log("INFO", fmt, a); va_end(a); }
+  void warn(const char* fmt, ...) const  { va_list a; va_start(a, fmt); log("WARN", fmt, a); va_end(a); }
+  void error(const char* fmt, ...) const { va_list a; va_start(a, fmt); log("ERROR", fmt, a); va_end(a); }
+
+};
+
+inline uint32_t millis(void) {
+  return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline void os_thread_yield(void) {
+  std::this_thread::yield();
+}
+
+// There are no interrupts to mask on a host. Simulated ISRs (e.g. signal
+// handlers) run on the interrupted thread, so compiler ordering is enough.
+inline int HAL_disable_irq(void) {
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+  return 0;
+}
+
+inline void HAL_enable_irq(int) {
+  std::atomic_signal_fence(std::memory_order_seq_cst);
+}
+
+#endif
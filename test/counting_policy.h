@@ -0,0 +1,24 @@
+/**
+ * A checksum policy that counts how much data it hashes
+ *
+ * Wraps CRC-32C, so pages stay compatible with the default policy. Tests and
+ * benchmarks use it to count full passes over a page.
+ */
+
+#ifndef PRA_COUNTING_POLICY_H
+#define PRA_COUNTING_POLICY_H
+
+#include "ParticleRetainedAtomic.h"
+
+struct CountingPolicy {
+  static size_t s_bytes;                // bytes hashed since the last reset()
+
+  static void reset(void) { s_bytes = 0; }
+
+  static uint32_t calculate(const void* data, size_t length, uint16_t seqNum) {
+    s_bytes += length;
+    return ParticleRetainedAtomicCrc32C::calculate(data, length, seqNum);
+  }
+};
+
+#endif
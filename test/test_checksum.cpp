@@ -0,0 +1,74 @@
+/**
+ * Checksum policies: reference vectors, and agreement between the fast paths
+ * (hardware CRC, word-wide byte sum, incremental updates) and a plain loop.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <vector>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+const char CHECK[] = "123456789";
+
+std::vector<uint8_t> randomBytes(size_t length, uint32_t seed) {
+  std::mt19937 rng(seed);
+  std::vector<uint8_t> bytes(length);
+  for (auto& b : bytes) b = (uint8_t)rng();
+  return bytes;
+}
+
+}
+
+TEST(Checksum, ReferenceVectors) {
+  EXPECT_EQ(0xE3069283u, ParticleRetainedAtomicCrc32C::calculate(CHECK, 9));
+  EXPECT_EQ(0xCBF43926u, ParticleRetainedAtomicCrc32::calculate(CHECK, 9));
+  EXPECT_EQ(0x091E01DEu, ParticleRetainedAtomicAdler32::calculate(CHECK, 9));
+  EXPECT_EQ(0x02CC5D05u, ParticleRetainedAtomicXxHash32::calculate("", 0, 0));
+  EXPECT_EQ(0x32D153FFu, ParticleRetainedAtomicXxHash32::calculate("abc", 3, 0));
+}
+
+TEST(Checksum, CrcChainsOverSplitBuffers) {
+  auto data = randomBytes(4099, 1);
+  uint32_t whole = ParticleRetainedAtomicCrc32C::calculate(data.data(), data.size());
+
+  for (size_t split : { 0, 1, 7, 8, 9, 1000, 4099 }) {
+    uint32_t crc = ParticleRetainedAtomicCrc32C::update(0, data.data(), split);
+    crc = ParticleRetainedAtomicCrc32C::update(crc, data.data() + split, data.size() - split);
+    EXPECT_EQ(whole, crc) << "split at " << split;
+  }
+}
+
+TEST(Checksum, ByteSumMatchesOriginalLoop) {
+  for (size_t length : { 1, 3, 16, 17, 511, 512, 513, 8192, 70000 }) {
+    auto data = randomBytes(length, (uint32_t)length);
+    uint16_t seqNum = 0xBEEF;
+
+    uint32_t sum = 0;
+    for (uint8_t b : data) sum += b;
+    sum += (0xff00 & seqNum) >> 8;
+    sum += seqNum & 0xff;
+
+    EXPECT_EQ(~sum, ParticleRetainedAtomicByteSum::calculate(data.data(), length, seqNum)) << "length " << length;
+  }
+}
+
+template<typename Policy>
+void expectIncrementalMatchesFull() {
+  auto oldPage = randomBytes(1024, 2);
+  auto newPage = oldPage;
+  for (size_t i = 100; i < 164; i++) newPage[i] ^= 0x5A;
+
+  uint32_t checksum = Policy::calculate(oldPage.data(), oldPage.size(), 7);
+  checksum = Policy::replaceSeqNum(checksum, oldPage.size(), 7, 8);
+  checksum = Policy::replace(checksum, oldPage.size(), 100, oldPage.data() + 100, newPage.data() + 100, 64);
+
+  EXPECT_EQ(Policy::calculate(newPage.data(), newPage.size(), 8), checksum);
+}
+
+TEST(Checksum, IncrementalCrc32CMatchesFull)  { expectIncrementalMatchesFull<ParticleRetainedAtomicCrc32C>(); }
+TEST(Checksum, IncrementalCrc32MatchesFull)   { expectIncrementalMatchesFull<ParticleRetainedAtomicCrc32>(); }
+TEST(Checksum, IncrementalByteSumMatchesFull) { expectIncrementalMatchesFull<ParticleRetainedAtomicByteSum>(); }
@@ -0,0 +1,121 @@
+/**
+ * Commit window: coalescing by calls and by time, flush() and what is lost
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <thread>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t counter;
+};
+
+const State DEFAULTS = { 0 };
+
+typedef ParticleRetainedAtomic<State> Atomic;
+
+struct Retained {
+  State pageA;
+  State pageB;
+  ParticleRetainedAtomicData_t data;
+  Retained() { memset(this, 0, sizeof(*this)); }
+};
+
+uint32_t restartedCounter(const Retained& mem) {
+  Retained copy = mem;
+  Atomic restarted(copy.pageA, copy.pageB, copy.data, DEFAULTS);
+  return restarted.committed().counter;
+}
+
+}
+
+TEST(CommitWindow, CoalescesByCallCount) {
+  Retained mem;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state.setCommitWindow(0, 3);
+
+  for (uint32_t i = 1; i <= 6; i++) {
+    state->counter = i;
+    state.save();
+    SCOPED_TRACE(i);
+    bool committed = (i % 3 == 0);      // every third call
+    EXPECT_EQ(!committed, state.commitPending());
+    EXPECT_EQ(committed ? i : i - i % 3, state.committed().counter);
+    EXPECT_EQ(committed ? i : i - i % 3, restartedCounter(mem));
+  }
+}
+
+TEST(CommitWindow, CoalescesByTime) {
+  Retained mem;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state.setCommitWindow(100);
+
+  state->counter = 1;
+  state.save();
+  EXPECT_TRUE(state.commitPending());
+  EXPECT_EQ(0u, restartedCounter(mem));
+
+  std::this_thread::sleep_for(std::chrono::milliseconds(150));
+  state->counter = 2;
+  state.save();
+  EXPECT_FALSE(state.commitPending());
+  EXPECT_EQ(2u, restartedCounter(mem));
+
+  state->counter = 3;                   // the window starts again at that commit
+  state.save();
+  EXPECT_TRUE(state.commitPending());
+  EXPECT_EQ(2u, restartedCounter(mem));
+}
+
+TEST(CommitWindow, FlushCommitsOnlyWhatIsPending) {
+  Retained mem;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state.setCommitWindow(0, 10);
+
+  EXPECT_FALSE(state.flush());          // nothing held back
+  state->counter = 1;
+  state.save();
+  EXPECT_TRUE(state.flush());
+  EXPECT_FALSE(state.commitPending());
+  EXPECT_EQ(1u, restartedCounter(mem));
+  EXPECT_FALSE(state.flush());
+
+  state->counter = 2;                   // written but never saved
+  EXPECT_FALSE(state.flush());
+  EXPECT_EQ(1u, restartedCounter(mem));
+}
+
+TEST(CommitWindow, RevertDiscardsCoalescedSaves) {
+  Retained mem;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state.setCommitWindow(0, 10);
+
+  state->counter = 1;
+  state.save();
+  state.revert();
+  EXPECT_FALSE(state.commitPending());
+  EXPECT_EQ(0u, state->counter);
+  EXPECT_FALSE(state.flush());
+  EXPECT_EQ(0u, restartedCounter(mem));
+}
+
+TEST(CommitWindow, ResetLosesCoalescedSaves) {
+  Retained mem;
+  {
+    Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+    state.setCommitWindow(0, 10);
+    state->counter = 1;
+    state.save();
+    state.flush();
+    state->counter = 2;
+    state.save();                       // held back, then the device resets
+  }
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(1u, state->counter);
+  EXPECT_FALSE(state.commitPending());
+}
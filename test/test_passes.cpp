@@ -0,0 +1,81 @@
+/**
+ * Construction hashes each page exactly once
+ */
+
+#include <gtest/gtest.h>
+
+#include "counting_policy.h"
+
+size_t CountingPolicy::s_bytes = 0;
+
+namespace {
+
+struct State {
+  uint8_t bytes[4000];
+};
+
+const State DEFAULTS = {};
+
+typedef ParticleRetainedAtomic<State, CountingPolicy> Atomic;
+
+struct Retained {
+  State pageA;
+  State pageB;
+  ParticleRetainedAtomicData_t data;
+  Retained() { memset(this, 0, sizeof(*this)); }
+};
+
+size_t passes(void) {
+  return CountingPolicy::s_bytes / sizeof(State);
+}
+
+}
+
+TEST(Passes, NoValidPage) {
+  Retained mem;
+
+  CountingPolicy::reset();
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(3u, passes());          // validate A and B, then save the default
+}
+
+TEST(Passes, OneValidPage) {
+  Retained mem;
+  { Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS); }
+
+  CountingPolicy::reset();
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(2u, passes());          // validate A and B; the restored page is not hashed again
+}
+
+TEST(Passes, BothPagesValid) {
+  Retained mem;
+  { Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS); }
+  mem.pageB = mem.pageA;
+  mem.data.seqNumB = mem.data.seqNumA + 1;
+  mem.data.checksumB = CountingPolicy::calculate(&mem.pageB, sizeof(State), mem.data.seqNumB);
+
+  CountingPolicy::reset();
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(2u, passes());
+}
+
+TEST(Passes, Ring) {
+  State pages[4] = {};
+  ParticleRetainedAtomicRingData_t<4> data = {};
+  { ParticleRetainedAtomic<State, CountingPolicy, 4> state(pages, data, DEFAULTS); }
+
+  CountingPolicy::reset();
+  ParticleRetainedAtomic<State, CountingPolicy, 4> state(pages, data, DEFAULTS);
+  EXPECT_EQ(4u, passes());
+}
+
+TEST(Passes, SaveHashesOnce) {
+  Retained mem;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+
+  CountingPolicy::reset();
+  state->bytes[0] = 1;
+  state.save();
+  EXPECT_EQ(1u, passes());
+}
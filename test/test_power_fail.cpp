@@ -0,0 +1,315 @@
+/**
+ * Simulated power failure with torn stores
+ *
+ * Every store the library makes into retained memory goes through a model
+ * that can cut the power at any store. The interrupted store is torn: a
+ * random subset of its bytes, or of its aligned 32-bit words, reaches memory,
+ * the rest keeps the old contents. The test then boots over the same memory
+ * and checks the invariant of the constructor's recovery: it restores
+ * exactly the state of the last save() that returned, or of the interrupted
+ * save(), never a mix and never the default value.
+ *
+ * Each configuration is run with the power cut at every store of a save(),
+ * and again at every store of the recovery that follows.
+ *
+ * The types in this file are in an anonymous namespace, so the templates are
+ * instantiated with the model here and with plain stores everywhere else.
+ */
+
+#include <setjmp.h>
+#include <string.h>
+
+#include <new>
+#include <random>
+
+#include <gtest/gtest.h>
+
+namespace {
+
+enum Granularity { Bytes = 1, Words = 4 };
+
+jmp_buf g_powerFail;
+long g_storesLeft = -1;                 // stores before the power fails, -1 for never
+Granularity g_granularity = Bytes;
+std::mt19937 g_rng;
+long g_stores = 0;                      // stores made while counting
+
+void modelCopy(void* dst, const void* src, size_t len) {
+  g_stores++;
+  if (g_storesLeft < 0 || g_storesLeft-- > 0) {
+    memcpy(dst, src, len);
+    return;
+  }
+
+  // power fails: each aligned unit of the store independently makes it or not
+  uint8_t* d = (uint8_t*)dst;
+  const uint8_t* s = (const uint8_t*)src;
+  size_t unit = g_granularity;
+  for (size_t i = 0; i < len; ) {
+    size_t end = ((uintptr_t)(d + i) / unit + 1) * unit - (uintptr_t)d;
+    if (end > len) end = len;
+    if (g_rng() & 1) memcpy(d + i, s + i, end - i);
+    i = end;
+  }
+  longjmp(g_powerFail, 1);
+}
+
+}
+
+#define PRA_RETAINED_COPY(dst, src, len)  modelCopy((dst), (src), (len))
+#define PRA_RETAINED_STORE(dst, value)    do { auto v = (value); modelCopy(&(dst), &v, sizeof(dst)); } while (0)
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t words[150];                  // crosses block and chunk boundaries unevenly
+};
+
+const State DEFAULTS = {};
+
+struct Retained {
+  State pages[3];
+  ParticleRetainedAtomicData_t abData;
+  ParticleRetainedAtomicChunkedData_t<State> chunkedData;
+  ParticleRetainedAtomicRingData_t<3> ringData;
+  State otherPages[2];
+  ParticleRetainedAtomicData_t otherData;
+  ParticleRetainedAtomicCommitRecord_t record;
+};
+
+Retained g_mem;
+
+const int ROUNDS = 100;                 // runs over every store index, with different tears
+
+// Objects are built in static storage: longjmp skips destructors, and none are needed
+template<typename Atomic>
+struct Storage {
+  alignas(Atomic) static uint8_t bytes[sizeof(Atomic)];
+};
+template<typename Atomic> alignas(Atomic) uint8_t Storage<Atomic>::bytes[sizeof(Atomic)];
+
+// new state: a few words of the old one changed, so dirty tracking copies little
+State changeState(const State& old, uint32_t generation) {
+  State state = old;
+  for (size_t i = generation % 7; i < 150; i += 37) state.words[i] = generation * 0x9E3779B1u;
+  return state;
+}
+
+// new state: a counter one up, so a byte sum changes by exactly one
+State countUp(const State& old, uint32_t) {
+  State state = old;
+  state.words[0]++;
+  return state;
+}
+
+template<typename Atomic>
+void saveFull(Atomic& a, const State& state) {
+  *a.operator->() = state;
+  a.save();
+}
+
+template<typename Atomic>
+void saveTracked(Atomic& a, const State& state) {
+  for (size_t i = 0; i < 150; i++) {
+    if (a.committed().words[i] == state.words[i]) continue;
+    a.markDirty(i * sizeof(uint32_t), sizeof(uint32_t));
+    a->words[i] = state.words[i];
+  }
+  a.save();
+}
+
+/**
+ * A configuration under test
+ *
+ * boot() constructs the object(s) over g_mem, save() writes a state and
+ * commits it, read() returns the restored state. With two objects in a
+ * transaction, both always hold the same state.
+ */
+struct PlainPages {
+  typedef ParticleRetainedAtomic<State> Atomic;
+  static Atomic* boot() { return new (Storage<Atomic>::bytes) Atomic(g_mem.pages[0], g_mem.pages[1], g_mem.abData, DEFAULTS); }
+  static void save(Atomic* a, const State& state) { saveFull(*a, state); }
+  static bool read(Atomic* a, State& state) { state = a->committed(); return true; }
+};
+
+struct DirtyPages : PlainPages {
+  static Atomic* boot() {
+    static Atomic::TrackingBuffer tracking;
+    Atomic* a = PlainPages::boot();
+    a->setTrackingBuffer(&tracking);
+    a->setDirtyTracking(true);
+    a->save();                          // the first save after enabling copies everything
+    return a;
+  }
+  static void save(Atomic* a, const State& state) { saveTracked(*a, state); }
+};
+
+struct ChunkedPages {
+  typedef ParticleRetainedAtomic<State> Atomic;
+  static Atomic* boot() {
+    static Atomic::TrackingBuffer tracking;
+    Atomic* a = new (Storage<Atomic>::bytes) Atomic(g_mem.pages[0], g_mem.pages[1], g_mem.chunkedData, DEFAULTS);
+    a->setTrackingBuffer(&tracking);
+    a->setDirtyTracking(true);
+    a->save();
+    return a;
+  }
+  static void save(Atomic* a, const State& state) { saveTracked(*a, state); }
+  static bool read(Atomic* a, State& state) { state = a->committed(); return true; }
+};
+
+struct ByteSumPages {
+  typedef ParticleRetainedAtomic<State, ParticleRetainedAtomicByteSum> Atomic;
+  static Atomic* boot() { return new (Storage<Atomic>::bytes) Atomic(g_mem.pages[0], g_mem.pages[1], g_mem.abData, DEFAULTS); }
+  static void save(Atomic* a, const State& state) { saveFull(*a, state); }
+  static bool read(Atomic* a, State& state) { state = a->committed(); return true; }
+};
+
+struct ByteSumLazyPages {
+  typedef ParticleRetainedAtomic<State, ParticleRetainedAtomicByteSum> Atomic;
+  static Atomic* boot() {
+    static Atomic::TrackingBuffer tracking;
+    Atomic* a = new (Storage<Atomic>::bytes) Atomic(g_mem.pages[0], g_mem.pages[1], g_mem.abData, DEFAULTS);
+    a->setTrackingBuffer(&tracking);
+    a->setLazySync(true);
+    a->save();
+    return a;
+  }
+  static void save(Atomic* a, const State& state) { saveTracked(*a, state); }
+  static bool read(Atomic* a, State& state) { state = a->committed(); return true; }
+};
+
+struct LazyRing {
+  typedef ParticleRetainedAtomic<State, ParticleRetainedAtomicCrc32C, 3> Atomic;
+  static Atomic* boot() {
+    static Atomic::TrackingBuffer tracking;
+    Atomic* a = new (Storage<Atomic>::bytes) Atomic(g_mem.pages, g_mem.ringData, DEFAULTS);
+    a->setTrackingBuffer(&tracking);
+    a->setLazySync(true);
+    a->save();
+    return a;
+  }
+  static void save(Atomic* a, const State& state) { saveTracked(*a, state); }
+  static bool read(Atomic* a, State& state) { state = a->committed(); return true; }
+};
+
+struct TwoObjectTransaction {
+  typedef ParticleRetainedAtomic<State> Atomic;
+  struct Pair { Atomic* first; Atomic* second; };
+  typedef Pair Objects;
+  static Pair* boot() {
+    static Pair pair;
+    pair.first = new (Storage<Atomic>::bytes) Atomic(g_mem.pages[0], g_mem.pages[1], g_mem.abData, DEFAULTS, g_mem.record);
+    pair.second = new (s_second) Atomic(g_mem.otherPages[0], g_mem.otherPages[1], g_mem.otherData, DEFAULTS, g_mem.record);
+    return &pair;
+  }
+  static void save(Pair* pair, const State& state) {
+    *pair->first->operator->() = state;
+    *pair->second->operator->() = state;
+    ParticleRetainedAtomicTransaction tx(g_mem.record);
+    tx.commit(*pair->first, *pair->second);
+  }
+  static bool read(Pair* pair, State& state) {
+    state = pair->first->committed();
+    return memcmp(&state, &pair->second->committed(), sizeof(State)) == 0;
+  }
+  alignas(Atomic) static uint8_t s_second[sizeof(Atomic)];
+};
+alignas(TwoObjectTransaction::Atomic) uint8_t TwoObjectTransaction::s_second[sizeof(TwoObjectTransaction::Atomic)];
+
+/**
+ * Cuts the power at every store of a save(), then at every store of the
+ * recovery after that, and checks what each recovery restores
+ *
+ * Once a cut has recovered the new state, every later cut of the same round
+ * must too: a save is committed at a single store.
+ *
+ * @param change  Derives each new state from the last one
+ * @return number of power cuts made
+ */
+template<typename Config>
+long cutEverywhere(Granularity granularity, State (*change)(const State&, uint32_t) = changeState) {
+
+  g_granularity = granularity;
+  g_rng.seed(granularity);
+  memset(&g_mem, 0, sizeof(g_mem));
+
+  // the last state saved without interruption
+  State committed;
+  g_storesLeft = -1;
+  Config::read(Config::boot(), committed);
+
+  long cuts = 0;
+  uint32_t generation = 0;
+
+  for (int round = 0; round < ROUNDS; round++) {
+    long committedAt = -1;
+    for (long cutAt = 0; ; cutAt++) {
+      State next = change(committed, ++generation);
+
+      // count the stores of boot + save, and undo them
+      Retained before = g_mem;
+      g_stores = 0;
+      Config::save(Config::boot(), next);
+      g_mem = before;
+      if (cutAt >= g_stores) break;
+
+      volatile bool finished = false;
+      g_storesLeft = cutAt;
+      if (setjmp(g_powerFail) == 0) {
+        Config::save(Config::boot(), next);
+        finished = true;
+      }
+      cuts++;
+
+      // on odd rounds the first recovery is cut short too
+      if (round % 2) {
+        g_storesLeft = g_rng() % 8;
+        if (setjmp(g_powerFail) == 0) Config::boot();
+      }
+
+      g_storesLeft = -1;
+      State recovered;
+      bool consistent = Config::read(Config::boot(), recovered);
+
+      bool isNew = memcmp(&recovered, &next, sizeof(State)) == 0;
+      bool isOld = memcmp(&recovered, &committed, sizeof(State)) == 0;
+      EXPECT_TRUE(consistent) << "objects of a transaction restored different states, cut at store " << cutAt;
+      EXPECT_TRUE(isNew || (isOld && !finished)) << "cut at store " << cutAt
+                                                  << (isOld ? ": lost a finished save" : ": restored a mixed or default state");
+      EXPECT_TRUE(isNew || committedAt < 0) << "cut at store " << cutAt << ": rolled back a save committed by store " << committedAt;
+      if (isNew && committedAt < 0) committedAt = cutAt;
+      if (::testing::Test::HasFailure()) return cuts;
+
+      committed = recovered;
+    }
+  }
+
+  return cuts;
+}
+
+}
+
+#define PRA_POWER_FAIL_TEST(Config)                             \
+  TEST(PowerFail, Config##ByteTears) {                          \
+    EXPECT_GT(cutEverywhere<Config>(Bytes), ROUNDS * 5);        \
+  }                                                             \
+  TEST(PowerFail, Config##WordTears) {                          \
+    EXPECT_GT(cutEverywhere<Config>(Words), ROUNDS * 5);        \
+  }
+
+PRA_POWER_FAIL_TEST(PlainPages)
+PRA_POWER_FAIL_TEST(DirtyPages)
+PRA_POWER_FAIL_TEST(ChunkedPages)
+PRA_POWER_FAIL_TEST(ByteSumPages)
+PRA_POWER_FAIL_TEST(LazyRing)
+
+// the stale page after a deferred swap differs from the saved one by exactly one in its byte sum
+TEST(PowerFail, ByteSumLazyCounterByteTears) {
+  EXPECT_GT(cutEverywhere<ByteSumLazyPages>(Bytes, countUp), ROUNDS * 5);
+}
+TEST(PowerFail, ByteSumLazyCounterWordTears) {
+  EXPECT_GT(cutEverywhere<ByteSumLazyPages>(Words, countUp), ROUNDS * 5);
+}
+PRA_POWER_FAIL_TEST(TwoObjectTransaction)
@@ -0,0 +1,230 @@
+/**
+ * Constructor recovery: each combination of valid pages, and save() round trips
+ */
+
+#include <gtest/gtest.h>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t counter;
+  float temperature;
+  uint8_t log[200];
+};
+
+const State DEFAULTS = { 42, 21.5f, {} };
+
+typedef ParticleRetainedAtomic<State> Atomic;
+
+// retained memory of one object; power cycles are simulated by constructing
+// a new object over the same struct
+struct Retained {
+  State pageA;
+  State pageB;
+  ParticleRetainedAtomicData_t data;
+  Retained() { memset(this, 0, sizeof(*this)); }
+};
+
+}
+
+TEST(Restore, NoValidPageRestoresDefault) {
+  Retained mem;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+
+  EXPECT_EQ(42u, state->counter);
+  EXPECT_EQ(42u, state.committed().counter);
+}
+
+TEST(Restore, SavedValueSurvivesRestart) {
+  Retained mem;
+  {
+    Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+    state->counter = 1;
+    state.save();
+    state->counter = 2;       // never saved
+  }
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(1u, state->counter);
+}
+
+// The constructor commits page A; after that each save() alternates, B first
+
+TEST(Restore, OnlyPageAValid) {
+  Retained mem;
+  {
+    Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+    state->counter = 7;
+    state.save();
+    state->counter = 8;
+    state.save();
+    EXPECT_EQ(&mem.pageA, &state.committed());
+  }
+  memset(&mem.pageB, 0xFF, sizeof(mem.pageB));
+
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(8u, state->counter);
+}
+
+TEST(Restore, OnlyPageBValid) {
+  Retained mem;
+  {
+    Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+    state->counter = 7;
+    state.save();
+    EXPECT_EQ(&mem.pageB, &state.committed());
+  }
+  memset(&mem.pageA, 0xFF, sizeof(mem.pageA));
+
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(7u, state->counter);
+}
+
+// Both pages are only valid at once after a reset inside save()
+static void setPage(State& page, uint16_t& seqNum, uint32_t& checksum, uint32_t counter, uint16_t seq) {
+  page = DEFAULTS;
+  page.counter = counter;
+  seqNum = seq;
+  checksum = ParticleRetainedAtomicCrc32C::calculate(&page, sizeof(State), seq);
+}
+
+TEST(Restore, BothValidPicksNewest) {
+  Retained mem;
+  setPage(mem.pageA, mem.data.seqNumA, mem.data.checksumA, 5, 5);
+  setPage(mem.pageB, mem.data.seqNumB, mem.data.checksumB, 6, 6);
+  {
+    Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+    EXPECT_EQ(6u, state->counter);
+  }
+
+  setPage(mem.pageA, mem.data.seqNumA, mem.data.checksumA, 5, 5);
+  setPage(mem.pageB, mem.data.seqNumB, mem.data.checksumB, 4, 4);
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(5u, state->counter);
+}
+
+TEST(Restore, SequenceNumberWrapsAround) {
+  Retained mem;
+  setPage(mem.pageA, mem.data.seqNumA, mem.data.checksumA, 111, UINT16_MAX);
+  setPage(mem.pageB, mem.data.seqNumB, mem.data.checksumB, 222, 1);
+
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(222u, state->counter);
+}
+
+TEST(Restore, CorruptSavedPageRestoresDefault) {
+  Retained mem;
+  {
+    Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+    state->counter = 1;
+    state.save();
+  }
+  mem.pageB.log[10] ^= 1;
+
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(42u, state->counter);
+}
+
+// A write that dirty tracking never saw breaks the derived checksums, until
+// the next commit of the whole page brings every page in line with it again
+TEST(Restore, UnrecordedWriteRecoversAtFullCommit) {
+  const uint32_t ANCHOR = PRA_CHECKSUM_ANCHOR;
+
+  Retained mem;
+  Atomic::TrackingBuffer tracking;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+  state.setDirtyTracking(true);
+  state.save();
+
+  state->log[100] = 1;                  // not recorded
+  for (uint32_t i = 1; i < ANCHOR + 4; i++) {
+    state.set(&State::counter, i);
+    state.save();
+    if (i + 1 < ANCHOR) continue;
+
+    SCOPED_TRACE(i);
+    Retained copy = mem;
+    Atomic restarted(copy.pageA, copy.pageB, copy.data, DEFAULTS);
+    EXPECT_EQ(i, restarted->counter);
+    EXPECT_EQ(1, restarted->log[100]);
+  }
+}
+
+// Pages saved before the checksum became a policy carry a byte sum; an
+// upgraded device keeps its state and converts the page once
+TEST(Restore, LegacyByteSumPageIsConverted) {
+  Retained mem;
+  mem.pageA = DEFAULTS;
+  mem.pageA.counter = 7;
+  mem.data.seqNumA = 9;
+  mem.data.checksumA = ParticleRetainedAtomicByteSum::calculate(&mem.pageA, sizeof(State), 9);
+  {
+    Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+    EXPECT_EQ(7u, state->counter);
+    EXPECT_EQ(&mem.pageB, &state.committed());
+  }
+  EXPECT_EQ(ParticleRetainedAtomicCrc32C::calculate(&mem.pageB, sizeof(State), mem.data.seqNumB), mem.data.checksumB);
+
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(7u, state->counter);
+}
+
+namespace {
+
+struct Large {
+  uint32_t words[256];                  // four 256-byte chunks
+};
+
+const Large LARGE_DEFAULTS = {};
+
+struct ChunkedRetained {
+  Large pageA;
+  Large pageB;
+  ParticleRetainedAtomicChunkedData_t<Large> data;
+  ChunkedRetained() { memset(this, 0, sizeof(*this)); }
+};
+
+typedef ParticleRetainedAtomic<Large> LargeAtomic;
+
+const size_t WORDS_PER_CHUNK = ParticleRetainedAtomicChunkedData_t<Large>::CHUNK_SIZE / sizeof(uint32_t);
+
+// Saves words[0] = 1 and a last chunk of 6, then leaves an unsaved 7 in the
+// last chunk of the other page; returns the saved page
+Large* saveTwoPages(ChunkedRetained& mem) {
+  LargeAtomic state(mem.pageA, mem.pageB, mem.data, LARGE_DEFAULTS);
+  state->words[0] = 1;
+  state->words[3 * WORDS_PER_CHUNK] = 5;
+  state.save();
+  state->words[3 * WORDS_PER_CHUNK] = 6;
+  state.save();
+  state->words[3 * WORDS_PER_CHUNK] = 7;
+  return (Large*)&state.committed();
+}
+
+}
+
+// A corrupt chunk that the other page holds unchanged is copied back from it
+TEST(Restore, CorruptChunkIsRepaired) {
+  ChunkedRetained mem;
+  Large* saved = saveTwoPages(mem);
+  saved->words[10] ^= 0x100;            // chunk 0
+
+  LargeAtomic state(mem.pageA, mem.pageB, mem.data, LARGE_DEFAULTS);
+  EXPECT_EQ(saved, &state.committed());
+  EXPECT_EQ(0u, saved->words[10]);
+  EXPECT_EQ(1u, state->words[0]);
+  EXPECT_EQ(6u, state->words[3 * WORDS_PER_CHUNK]);
+}
+
+// A corrupt chunk that differs on the other page cannot be repaired, and the
+// other page holds no valid save either
+TEST(Restore, CorruptChunkChangedSinceCannotBeRepaired) {
+  ChunkedRetained mem;
+  Large* saved = saveTwoPages(mem);
+  saved->words[3 * WORDS_PER_CHUNK + 1] ^= 0x100;   // chunk 3
+
+  LargeAtomic state(mem.pageA, mem.pageB, mem.data, LARGE_DEFAULTS);
+  EXPECT_EQ(0, memcmp(&LARGE_DEFAULTS, &state.committed(), sizeof(Large)));
+}
@@ -0,0 +1,181 @@
+/**
+ * Ring of N pages: older generations under dirty tracking
+ *
+ * Each page other than the scratchpad may hold any older generation, so the
+ * blocks it lacks must never be forgotten, whatever happens between saves.
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t words[256];                  // 32 blocks
+};
+
+const State DEFAULTS = {};
+
+template<size_t N>
+struct Ring {
+  State pages[N];
+  ParticleRetainedAtomicRingData_t<N> data;
+  Ring() { memset(this, 0, sizeof(*this)); }
+};
+
+template<size_t N>
+using Atomic = ParticleRetainedAtomic<State, ParticleRetainedAtomicCrc32C, N>;
+
+template<size_t N>
+void write(Atomic<N>& state, State& expected, size_t word, uint32_t value) {
+  state.markDirty(word * sizeof(uint32_t), sizeof(uint32_t));
+  state->words[word] = value;
+  expected.words[word] = value;
+}
+
+template<size_t N>
+void expectSaved(Atomic<N>& state, Ring<N>& mem, const State& expected) {
+  EXPECT_EQ(0, memcmp(&state.committed(), &expected, sizeof(State)));
+  EXPECT_EQ(0, memcmp(&state.getScratchpad(), &expected, sizeof(State)));
+
+  Ring<N> copy = mem;
+  Atomic<N> restarted(copy.pages, copy.data, DEFAULTS);
+  EXPECT_EQ(0, memcmp(&restarted.committed(), &expected, sizeof(State)));
+}
+
+// Fills every page of the ring with a different generation
+template<size_t N>
+State fillRing(Ring<N>& mem) {
+  Atomic<N> state(mem.pages, mem.data, DEFAULTS);
+  for (uint32_t i = 0; i < 2 * N; i++) {
+    for (size_t word = 0; word < 256; word++) state->words[word] = i * 1000 + word;
+    state.save();
+  }
+  return state.committed();
+}
+
+template<size_t N>
+void revertAfterEnablingTracking() {
+  Ring<N> mem;
+  State expected = fillRing(mem);
+
+  typename Atomic<N>::TrackingBuffer tracking;
+  Atomic<N> state(mem.pages, mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+  state.setDirtyTracking(true);
+  state.markDirty(7 * sizeof(uint32_t), sizeof(uint32_t));
+  state->words[7] = 0xDEAD;
+  state.revert();
+
+  for (uint32_t i = 0; i < 2 * N; i++) {
+    write(state, expected, 100 + i, i);
+    state.save();
+    SCOPED_TRACE(i);
+    expectSaved(state, mem, expected);
+  }
+}
+
+template<size_t N>
+void randomWritesAndReverts() {
+  Ring<N> mem;
+  State expected = fillRing(mem);
+  std::mt19937 rng(N);
+
+  typename Atomic<N>::TrackingBuffer tracking;
+  Atomic<N> state(mem.pages, mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+  for (int i = 0; i < 500; i++) {
+    switch (rng() % 8) {
+      case 0:  state.setDirtyTracking(false); break;
+      case 1:  state.setDirtyTracking(true); break;
+      case 2:  state.revert(); expected = state.committed(); break;
+      case 3:  state.save(); break;
+      default: write(state, expected, rng() % 256, rng()); break;
+    }
+    if (rng() % 4 == 0) {
+      state.save();
+      SCOPED_TRACE(i);
+      expectSaved(state, mem, expected);
+    }
+  }
+}
+
+// An ISR write is not in m_dirty, so a save() from the thread must not trust it
+template<size_t N>
+void saveAfterISRWrite() {
+  Ring<N> mem;
+  State expected = fillRing(mem);
+
+  typename Atomic<N>::TrackingBuffer tracking;
+  Atomic<N> state(mem.pages, mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+  state.setLazySync(true);
+  for (uint32_t i = 0; i < 2 * N; i++) {
+    state.scratchpadFromISR()->words[200] = i;   // as if from an interrupt
+    expected.words[200] = i;
+    state.saveFromISR();
+
+    write(state, expected, 10 + i, i);
+    state.save();
+    SCOPED_TRACE(i);
+    expectSaved(state, mem, expected);
+  }
+  EXPECT_TRUE(state.commitISRSaves());
+}
+
+// Calls an "ISR" each time a page is checksummed, as if it fired during the commit
+struct InterruptingPolicy {
+  static void (*s_isr)(void);
+
+  static uint32_t calculate(const void* data, size_t length, uint16_t seqNum) {
+    if (s_isr) s_isr();
+    return ParticleRetainedAtomicCrc32C::calculate(data, length, seqNum);
+  }
+};
+void (*InterruptingPolicy::s_isr)(void) = nullptr;
+
+typedef ParticleRetainedAtomic<State, InterruptingPolicy, 3> Interrupted;
+Interrupted* g_interrupted = nullptr;
+
+void saveFromInterrupt(void) {
+  g_interrupted->scratchpadFromISR()->words[0]++;
+  g_interrupted->saveFromISR();
+}
+
+}
+
+// An ISR that saves during every commit attempt must not hang save()
+TEST(Ring, SaveGivesUpWhileISRsKeepSaving) {
+  Ring<3> mem;
+  Interrupted state(mem.pages, mem.data, DEFAULTS);
+  state.setISRWrites();
+  state->words[1] = 7;
+
+  g_interrupted = &state;
+  InterruptingPolicy::s_isr = saveFromInterrupt;
+  state.save();
+  EXPECT_TRUE(state.commitPending());
+  EXPECT_FALSE(state.flush());
+  EXPECT_EQ(0u, state.committed().words[1]);
+
+  InterruptingPolicy::s_isr = nullptr;
+  EXPECT_TRUE(state.flush());
+  EXPECT_FALSE(state.commitPending());
+  EXPECT_EQ(7u, state.committed().words[1]);
+  EXPECT_EQ(state.committed().words[0], state.getScratchpad().words[0]);
+  EXPECT_TRUE(state.commitISRSaves());
+}
+
+TEST(Ring, SaveAfterISRWrite3) { saveAfterISRWrite<3>(); }
+TEST(Ring, SaveAfterISRWrite4) { saveAfterISRWrite<4>(); }
+
+TEST(Ring, RevertAfterEnablingTracking3) { revertAfterEnablingTracking<3>(); }
+TEST(Ring, RevertAfterEnablingTracking4) { revertAfterEnablingTracking<4>(); }
+TEST(Ring, RevertAfterEnablingTracking5) { revertAfterEnablingTracking<5>(); }
+
+TEST(Ring, RandomWritesAndReverts3) { randomWritesAndReverts<3>(); }
+TEST(Ring, RandomWritesAndReverts4) { randomWritesAndReverts<4>(); }
+TEST(Ring, RandomWritesAndReverts5) { randomWritesAndReverts<5>(); }
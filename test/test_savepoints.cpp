@@ -0,0 +1,163 @@
+/**
+ * Savepoints: nesting, undo buffer overflow and lazy sync
+ */
+
+#include <gtest/gtest.h>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t words[64];                   // 8 blocks
+};
+
+const State DEFAULTS = {};
+
+typedef ParticleRetainedAtomic<State> Atomic;
+
+const size_t WORDS_PER_BLOCK = Atomic::BLOCK_SIZE / sizeof(uint32_t);
+
+struct Retained {
+  State pageA;
+  State pageB;
+  ParticleRetainedAtomicData_t data;
+  Retained() { memset(this, 0, sizeof(*this)); }
+};
+
+// Records the write first, as savepoints require
+void write(Atomic& state, size_t word, uint32_t value) {
+  state.markDirty(word * sizeof(uint32_t), sizeof(uint32_t));
+  state->words[word] = value;
+}
+
+template<size_t Entries = 8>
+struct Fixture {
+  Retained mem;
+  Atomic::TrackingBuffer tracking;
+  Atomic::UndoBuffer<Entries> undo;
+  Atomic state;
+
+  Fixture() : state(mem.pageA, mem.pageB, mem.data, DEFAULTS) {
+    state.setTrackingBuffer(&tracking);
+    state.setDirtyTracking(true);
+    state.setUndoBuffer(&undo);
+  }
+};
+
+}
+
+TEST(Savepoints, NeedTrackingAndABuffer) {
+  Retained mem;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  Atomic::UndoBuffer<4> undo;
+  state.setUndoBuffer(&undo);
+  EXPECT_FALSE(state.savepoint());      // no tracking buffer, so no dirty tracking
+
+  Atomic::TrackingBuffer tracking;
+  state.setTrackingBuffer(&tracking);
+  state.setDirtyTracking(true);
+  EXPECT_TRUE(state.savepoint());
+
+  state.setUndoBuffer(nullptr);
+  EXPECT_FALSE(state.savepoint());
+}
+
+TEST(Savepoints, NestedRollbacksUndoOneLevelEach) {
+  Fixture<> f;
+  write(f.state, 0, 1);
+
+  ASSERT_TRUE(f.state.savepoint());
+  write(f.state, 0, 2);
+  ASSERT_TRUE(f.state.savepoint());
+  write(f.state, 0, 3);
+  write(f.state, 3 * WORDS_PER_BLOCK, 4);
+
+  EXPECT_TRUE(f.state.rollbackToSavepoint());
+  EXPECT_EQ(2u, f.state->words[0]);
+  EXPECT_EQ(0u, f.state->words[3 * WORDS_PER_BLOCK]);
+
+  EXPECT_TRUE(f.state.rollbackToSavepoint());
+  EXPECT_EQ(1u, f.state->words[0]);
+  EXPECT_FALSE(f.state.rollbackToSavepoint());   // none left
+
+  f.state.save();
+  Atomic restarted(f.mem.pageA, f.mem.pageB, f.mem.data, DEFAULTS);
+  EXPECT_EQ(1u, restarted.committed().words[0]);
+}
+
+// Releasing an inner savepoint merges its log into the outer one, so a block
+// logged for the inner one needs no second entry
+TEST(Savepoints, ReleasedInnerSavepointRollsBackWithOuter) {
+  Fixture<2> f;
+  write(f.state, 0, 1);
+
+  ASSERT_TRUE(f.state.savepoint());
+  write(f.state, 1, 2);                 // block 0, logged for the outer savepoint
+  ASSERT_TRUE(f.state.savepoint());
+  write(f.state, 2 * WORDS_PER_BLOCK, 3);   // block 2, logged only for the inner one
+  f.state.releaseSavepoint();
+  write(f.state, 2 * WORDS_PER_BLOCK, 4);   // not logged again after the merge
+
+  EXPECT_TRUE(f.state.rollbackToSavepoint());
+  EXPECT_EQ(1u, f.state->words[0]);
+  EXPECT_EQ(0u, f.state->words[1]);
+  EXPECT_EQ(0u, f.state->words[2 * WORDS_PER_BLOCK]);
+}
+
+TEST(Savepoints, TooManyNested) {
+  Fixture<> f;
+  for (size_t i = 0; i < Atomic::MAX_SAVEPOINTS; i++) EXPECT_TRUE(f.state.savepoint());
+  EXPECT_FALSE(f.state.savepoint());
+
+  f.state.save();                       // drops them all
+  EXPECT_TRUE(f.state.savepoint());
+}
+
+TEST(Savepoints, OverflowLeavesScratchpadUnchanged) {
+  Retained mem;
+  Atomic::TrackingBuffer tracking;
+  Atomic::UndoBuffer<1> undo;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+  state.setDirtyTracking(true);
+  state.setUndoBuffer(&undo);
+
+  ASSERT_TRUE(state.savepoint());
+  write(state, 0, 1);
+  write(state, WORDS_PER_BLOCK, 2);     // a second block does not fit
+
+  EXPECT_FALSE(state.rollbackToSavepoint());
+  EXPECT_EQ(1u, state->words[0]);
+  EXPECT_EQ(2u, state->words[WORDS_PER_BLOCK]);
+
+  state.save();                         // empties the log
+  ASSERT_TRUE(state.savepoint());
+  write(state, 0, 3);
+  EXPECT_TRUE(state.rollbackToSavepoint());
+  EXPECT_EQ(1u, state->words[0]);
+}
+
+// A block still pending after a lazy save() must be logged as the saved page
+// holds it, not as the stale scratchpad does
+TEST(Savepoints, LazySyncLogsSyncedBlocks) {
+  Fixture<> f;
+  f.state.setLazySync(true);
+  for (uint32_t i = 1; i <= 3; i++) {
+    write(f.state, 0, i);
+    write(f.state, 5 * WORDS_PER_BLOCK, 10 * i);
+    f.state.save();                     // checksum only, the next scratchpad lacks both blocks
+  }
+
+  ASSERT_TRUE(f.state.savepoint());
+  write(f.state, 5 * WORDS_PER_BLOCK, 99);
+  EXPECT_TRUE(f.state.rollbackToSavepoint());
+  EXPECT_EQ(30u, f.state.getScratchpad().words[5 * WORDS_PER_BLOCK]);
+  EXPECT_EQ(3u, f.state.getScratchpad().words[0]);
+
+  write(f.state, 0, 4);
+  f.state.save();
+  Atomic restarted(f.mem.pageA, f.mem.pageB, f.mem.data, DEFAULTS);
+  EXPECT_EQ(4u, restarted.committed().words[0]);
+  EXPECT_EQ(30u, restarted.committed().words[5 * WORDS_PER_BLOCK]);
+}
@@ -0,0 +1,114 @@
+/**
+ * Deferred saves: sync(maxBytes) progress, alone and between writes and saves
+ */
+
+#include <gtest/gtest.h>
+
+#include <random>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t words[256];                  // 32 blocks
+};
+
+const State DEFAULTS = {};
+
+typedef ParticleRetainedAtomic<State> Atomic;
+
+const size_t BLOCKS = sizeof(State) / Atomic::BLOCK_SIZE;
+const size_t WORDS_PER_BLOCK = Atomic::BLOCK_SIZE / sizeof(uint32_t);
+
+struct Retained {
+  State pages[2];
+  ParticleRetainedAtomicData_t data;
+  Retained() { memset(this, 0, sizeof(*this)); }
+};
+
+// The scratchpad page, read from retained memory so that nothing is synced on the way
+State& scratchPage(Atomic& state, Retained& mem) {
+  return (&state.committed() == &mem.pages[0]) ? mem.pages[1] : mem.pages[0];
+}
+
+// Blocks of the scratchpad page that already match the saved page
+size_t syncedBlocks(Atomic& state, Retained& mem) {
+  const State& saved = state.committed();
+  const State& scratch = scratchPage(state, mem);
+  size_t synced = 0;
+  for (size_t block = 0; block < BLOCKS; block++) {
+    synced += memcmp(&saved.words[block * WORDS_PER_BLOCK], &scratch.words[block * WORDS_PER_BLOCK], Atomic::BLOCK_SIZE) == 0;
+  }
+  return synced;
+}
+
+// Saves a state that differs from the other page in every block, deferred
+void saveEveryBlockDeferred(Atomic& state, uint32_t value) {
+  for (size_t word = 0; word < 256; word++) state->words[word] = value;
+  state.save(Atomic::Deferred);
+}
+
+}
+
+TEST(Sync, CopiesAtMostMaxBytesRoundedUp) {
+  Retained mem;
+  Atomic::TrackingBuffer tracking;
+  Atomic state(mem.pages[0], mem.pages[1], mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+
+  const size_t maxBytes[] = { 0, 1, 32, 48, 100 };
+  for (size_t bytes : maxBytes) {
+    SCOPED_TRACE(bytes);
+    saveEveryBlockDeferred(state, (uint32_t)bytes + 1);
+    size_t perCall = (bytes + Atomic::BLOCK_SIZE - 1) / Atomic::BLOCK_SIZE;
+    if (perCall == 0) perCall = 1;
+
+    size_t before = syncedBlocks(state, mem);
+    EXPECT_EQ(0u, before);
+    for (size_t call = 1; before < BLOCKS; call++) {
+      bool done = state.sync(bytes);
+      size_t after = syncedBlocks(state, mem);
+      EXPECT_EQ(std::min(BLOCKS, before + perCall), after);
+      EXPECT_EQ(after == BLOCKS, done);          // true only once nothing is left
+      before = after;
+    }
+    EXPECT_TRUE(state.sync(bytes));
+  }
+}
+
+TEST(Sync, ConsistentBetweenWritesAndSaves) {
+  Retained mem;
+  Atomic::TrackingBuffer tracking;
+  Atomic state(mem.pages[0], mem.pages[1], mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+  state.setLazySync(true);
+  State expected = DEFAULTS;
+  std::mt19937 rng(16);
+
+  for (int i = 0; i < 2000; i++) {
+    switch (rng() % 4) {
+      case 0: {
+        size_t word = rng() % 256;
+        uint32_t value = rng();
+        state.markDirty(word * sizeof(uint32_t), sizeof(uint32_t));
+        scratchPage(state, mem).words[word] = value;   // as through a pointer, syncing nothing else
+        expected.words[word] = value;
+        break;
+      }
+      case 1:
+        state.save(rng() % 2 ? Atomic::Deferred : Atomic::Immediate);
+        EXPECT_EQ(0, memcmp(&expected, &state.committed(), sizeof(State))) << i;
+        break;
+      default:
+        state.sync(rng() % 200);
+        break;
+    }
+  }
+
+  EXPECT_EQ(0, memcmp(&expected, &state.getScratchpad(), sizeof(State)));
+  state.save();
+  Retained copy = mem;
+  Atomic restarted(copy.pages[0], copy.pages[1], copy.data, DEFAULTS);
+  EXPECT_EQ(0, memcmp(&expected, &restarted.committed(), sizeof(State)));
+}
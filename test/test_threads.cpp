@@ -0,0 +1,164 @@
+/**
+ * Readers on other threads: readCommitted(), snapshots and transactions
+ */
+
+#include <gtest/gtest.h>
+
+#include <chrono>
+#include <future>
+#include <thread>
+
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t counter;
+  uint8_t log[200];
+};
+
+const State DEFAULTS = { 42, {} };
+
+typedef ParticleRetainedAtomic<State> Atomic;
+
+struct Retained {
+  State pageA;
+  State pageB;
+  ParticleRetainedAtomicData_t data;
+  Retained() { memset(this, 0, sizeof(*this)); }
+};
+
+const std::chrono::seconds TIMEOUT(2);
+
+}
+
+// A save() waiting for a snapshot must not hold off readCommitted()
+TEST(Threads, ReadCommittedWhileSaveWaitsForSnapshot) {
+  Retained mem;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state->counter = 1;
+  state.save();
+
+  std::future<void> saving;
+  std::future<uint32_t> reading;
+  {
+    auto snapshot = state.acquireSnapshot();
+    state->counter = 2;
+    saving = std::async(std::launch::async, [&] { state.save(); });
+    EXPECT_EQ(std::future_status::timeout, saving.wait_for(std::chrono::milliseconds(50)));
+
+    reading = std::async(std::launch::async, [&] {
+      State copy;
+      state.readCommitted(copy);
+      return copy.counter;
+    });
+    EXPECT_EQ(std::future_status::ready, reading.wait_for(TIMEOUT));
+    EXPECT_EQ(1u, snapshot->counter);
+  }
+  saving.get();
+  EXPECT_EQ(2u, reading.get());
+}
+
+// Transactions from other threads while the owner keeps saving and flushing
+TEST(Threads, TransactionsWhileOwnerSaves) {
+  const uint32_t INCREMENTS = 20000;
+
+  Retained mem;
+  Atomic::TrackingBuffer tracking;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+  state.setDirtyTracking(true);
+  state.setCommitWindow(0, 3);
+
+  std::atomic<int> running(2);
+  auto increment = [&] {
+    for (uint32_t i = 0; i < INCREMENTS; i++) {
+      for (;;) {
+        auto tx = state.beginTransaction();
+        tx->counter++;
+        if (tx.commit()) break;
+      }
+    }
+    running--;
+  };
+  std::thread first(increment), second(increment);
+
+  for (int i = 0; running; i++) {
+    state.save();
+    if (i % 7 == 0) state.flush();
+    if (i % 11 == 0) state.revert();
+  }
+  first.join();
+  second.join();
+
+  EXPECT_EQ(DEFAULTS.counter + 2 * INCREMENTS, state.committed().counter);
+  Atomic restarted(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(DEFAULTS.counter + 2 * INCREMENTS, restarted.committed().counter);
+}
+
+// A transaction must not overwrite the owner's writes in the blocks it changes
+TEST(Threads, TransactionKeepsOwnerWritesInItsBlocks) {
+  Retained mem;
+  Atomic::TrackingBuffer tracking;
+  Atomic state(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  state.setTrackingBuffer(&tracking);
+  state.setDirtyTracking(true);
+  state.setCommitWindow(0, 10);
+
+  state->log[0] = 5;                    // same block as counter
+  state.save();
+  EXPECT_TRUE(state.commitPending());   // held back by the commit window
+
+  auto tx = state.beginTransaction();
+  tx->counter++;
+  EXPECT_TRUE(tx.commit());
+  EXPECT_FALSE(state.commitPending());
+  EXPECT_EQ(5, state.committed().log[0]);
+
+  state->log[1] = 9;                    // not saved at all
+  auto next = state.beginTransaction();
+  next->counter++;
+  EXPECT_TRUE(next.commit());
+  EXPECT_EQ(9, state->log[1]);
+
+  Atomic restarted(mem.pageA, mem.pageB, mem.data, DEFAULTS);
+  EXPECT_EQ(DEFAULTS.counter + 2, restarted.committed().counter);
+  EXPECT_EQ(5, restarted.committed().log[0]);
+  EXPECT_EQ(9, restarted.committed().log[1]);
+}
+
+// Transactions over the same objects, listed in opposite orders, while an owner saves
+TEST(Threads, MultiObjectTransactionsWhileOwnerSaves) {
+  const int COMMITS = 200000;
+
+  Retained memA, memB;
+  ParticleRetainedAtomicCommitRecord_t record = {};
+  Atomic first(memA.pageA, memA.pageB, memA.data, DEFAULTS, record);
+  Atomic second(memB.pageA, memB.pageB, memB.data, DEFAULTS, record);
+  first->counter = 1;
+  second->counter = 2;
+  ParticleRetainedAtomicTransaction(record).commit(first, second);
+
+  std::atomic<int> running(2);
+  auto forward = [&] {
+    for (int i = 0; i < COMMITS; i++) ParticleRetainedAtomicTransaction(record).commit(first, second);
+    running--;
+  };
+  auto backward = [&] {
+    for (int i = 0; i < COMMITS; i++) ParticleRetainedAtomicTransaction(record).commit(second, first);
+    running--;
+  };
+  auto done = std::async(std::launch::async, [&] {
+    std::thread one(forward), other(backward);
+    one.join();
+    other.join();
+  });
+  auto deadline = std::chrono::steady_clock::now() + 5 * TIMEOUT;
+  while (running && std::chrono::steady_clock::now() < deadline) first.save();
+  ASSERT_EQ(std::future_status::ready, done.wait_for(TIMEOUT));
+
+  Atomic restartedFirst(memA.pageA, memA.pageB, memA.data, DEFAULTS, record);
+  Atomic restartedSecond(memB.pageA, memB.pageB, memB.data, DEFAULTS, record);
+  EXPECT_EQ(1u, restartedFirst.committed().counter);
+  EXPECT_EQ(2u, restartedSecond.committed().counter);
+}
@@ -0,0 +1,220 @@
+/**
+ * Crash-consistency torture test: fork, kill mid-save, recover, check
+ *
+ * The retained pages live in a shared anonymous mapping. Each iteration forks
+ * a child that boots (constructs the object over the mapping) and saves a new
+ * state. Every store the library makes into retained memory goes through
+ * PRA_RETAINED_COPY/PRA_RETAINED_STORE; the child counts them and, at a
+ * randomly chosen store, writes a random number of its bytes and SIGKILLs
+ * itself. Stores inside SavePage::operator=, copyBlocks() and writeChecksum()
+ * are therefore torn at byte granularity, like a brownout would.
+ *
+ * The parent then boots over the same memory and checks that it recovered
+ * exactly the old or the new state, and the new one if the child finished.
+ *
+ *   pra_torture [iterations per mode] [seed]
+ *
+ * POSIX only.
+ */
+
+#include <limits.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <limits.h>
+
+#include <algorithm>
+#include <chrono>
+#include <random>
+
+static bool g_armed = false;            // only ever set in the child
+static unsigned long g_stores;          // stores made since arming
+static unsigned long g_killAt;          // store to tear, 1-based
+static size_t g_tearBytes;              // bytes of that store to write, may exceed its length
+
+static void tornCopy(void* dst, const void* src, size_t len) {
+  if (g_armed && ++g_stores == g_killAt) {
+    memcpy(dst, src, std::min(len, g_tearBytes % (len + 1)));
+    kill(getpid(), SIGKILL);
+  }
+  memcpy(dst, src, len);
+}
+
+#define PRA_RETAINED_COPY(dst, src, len)  tornCopy((dst), (src), (len))
+#define PRA_RETAINED_STORE(dst, value)    do { auto v = (value); tornCopy(&(dst), &v, sizeof(dst)); } while (0)
+#include "ParticleRetainedAtomic.h"
+
+namespace {
+
+struct State {
+  uint32_t words[300];                  // not a multiple of the 32-byte block or 256-byte chunk
+};
+
+const State DEFAULTS = {};
+
+struct Shared {
+  State pages[3];
+  ParticleRetainedAtomicData_t abData;
+  ParticleRetainedAtomicChunkedData_t<State> chunkedData;
+  ParticleRetainedAtomicRingData_t<3> ringData;
+  unsigned long stores;                 // stores made by the last child that finished
+};
+
+struct PlainPages {
+  static const char* name() { return "A/B"; }
+  template<typename F> static void boot(Shared& s, F f) {
+    ParticleRetainedAtomic<State> state(s.pages[0], s.pages[1], s.abData, DEFAULTS);
+    f(state);
+  }
+};
+
+struct ChunkedPages {
+  static const char* name() { return "chunked"; }
+  template<typename F> static void boot(Shared& s, F f) {
+    ParticleRetainedAtomic<State> state(s.pages[0], s.pages[1], s.chunkedData, DEFAULTS);
+    f(state);
+  }
+};
+
+struct ByteSumPages {
+  static const char* name() { return "byte-sum"; }
+  template<typename F> static void boot(Shared& s, F f) {
+    ParticleRetainedAtomic<State, ParticleRetainedAtomicByteSum> state(s.pages[0], s.pages[1], s.abData, DEFAULTS);
+    f(state);
+  }
+};
+
+struct RingPages {
+  static const char* name() { return "ring of 3"; }
+  template<typename F> static void boot(Shared& s, F f) {
+    ParticleRetainedAtomic<State, ParticleRetainedAtomicCrc32C, 3> state(s.pages, s.ringData, DEFAULTS);
+    f(state);
+  }
+};
+
+unsigned long g_iterationsRun = 0;
+
+enum Tracking { Full, Dirty, Lazy };
+
+const char* trackingName(Tracking tracking) {
+  return tracking == Full ? "full copy" : tracking == Dirty ? "dirty tracking" : "lazy sync";
+}
+
+/**
+ * Boots over the mapping and saves newState, recording writes per block
+ *
+ * With tracking, the old state is saved once first, so the second save()
+ * takes the incremental checksum and partial copy paths.
+ */
+template<typename Atomic>
+void saveState(Atomic& state, const State& newState, Tracking tracking) {
+  typename Atomic::TrackingBuffer buffer;
+  state.setTrackingBuffer(&buffer);
+  if (tracking == Dirty) state.setDirtyTracking(true);
+  if (tracking == Lazy)  state.setLazySync(true);
+  if (tracking != Full)  state.save();
+
+  for (size_t i = 0; i < sizeof(State) / sizeof(uint32_t); i++) {
+    if (state->words[i] == newState.words[i]) continue;
+    if (tracking != Full) state.markDirty(i * sizeof(uint32_t), sizeof(uint32_t));
+    state->words[i] = newState.words[i];
+  }
+  state.save();
+}
+
+template<typename Pages>
+bool torture(Shared& shm, Tracking tracking, unsigned long iterations, std::mt19937& rng) {
+
+  State oldState;
+  Pages::boot(shm, [&](auto& state) { oldState = state.committed(); });
+
+  unsigned long maxStores = 0, torn = 0, completed = 0;   // most stores made by a child that finished
+
+  for (unsigned long it = 0; it < iterations; it++, g_iterationsRun++) {
+    State newState = oldState;
+    for (int n = rng() % 20; n >= 0; n--) newState.words[rng() % 300] = rng();
+
+    // the first child runs to completion to count the stores; later ones sometimes do
+    unsigned long killAt = maxStores ? 1 + rng() % (maxStores + maxStores / 4 + 1) : ULONG_MAX;
+    size_t tearBytes = rng();
+
+    pid_t child = fork();
+    if (child < 0) { perror("fork"); return false; }
+    if (child == 0) {
+      g_armed = true;
+      g_stores = 0;
+      g_killAt = killAt;
+      g_tearBytes = tearBytes;
+      Pages::boot(shm, [&](auto& state) { saveState(state, newState, tracking); });
+      shm.stores = g_stores;
+      _exit(0);
+    }
+
+    int status;
+    waitpid(child, &status, 0);
+    bool finished = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    if (finished) {
+      completed++;
+      maxStores = std::max(maxStores, shm.stores);
+    }
+    else if (WIFSIGNALED(status) && WTERMSIG(status) == SIGKILL) {
+      torn++;
+    }
+    else {
+      fprintf(stderr, "%s, %s: child failed with status %d\n", Pages::name(), trackingName(tracking), status);
+      return false;
+    }
+
+    State recovered;
+    Pages::boot(shm, [&](auto& state) { recovered = state.committed(); });
+
+    bool isNew = memcmp(&recovered, &newState, sizeof(State)) == 0;
+    bool isOld = memcmp(&recovered, &oldState, sizeof(State)) == 0;
+    if (!(isNew || (isOld && !finished))) {
+      fprintf(stderr, "%s, %s: iteration %lu recovered %s state (killed at store %lu of %lu, %zu bytes)\n",
+              Pages::name(), trackingName(tracking), it, isOld ? "the old" : "a mixed or default",
+              killAt, maxStores, tearBytes);
+      return false;
+    }
+    oldState = recovered;
+  }
+
+  printf("%-10s %-15s %8lu iterations, %8lu torn, %8lu completed, up to %lu stores\n",
+         Pages::name(), trackingName(tracking), iterations, torn, completed, maxStores);
+  return true;
+}
+
+}
+
+int main(int argc, char** argv) {
+
+  unsigned long iterations = (argc > 1) ? strtoul(argv[1], nullptr, 0) : 10000;
+  unsigned long seed = (argc > 2) ? strtoul(argv[2], nullptr, 0) : 1;
+
+  Shared* shm = (Shared*)mmap(nullptr, sizeof(Shared), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+  if (shm == MAP_FAILED) { perror("mmap"); return 1; }
+
+  std::mt19937 rng(seed);
+  auto start = std::chrono::steady_clock::now();
+  bool ok = true;
+
+  for (Tracking tracking : { Full, Dirty, Lazy }) {
+    memset(shm, 0, sizeof(Shared));
+    ok = ok && torture<PlainPages>(*shm, tracking, iterations, rng);
+    memset(shm, 0, sizeof(Shared));
+    ok = ok && torture<ChunkedPages>(*shm, tracking, iterations, rng);
+    memset(shm, 0, sizeof(Shared));
+    ok = ok && torture<ByteSumPages>(*shm, tracking, iterations, rng);
+    memset(shm, 0, sizeof(Shared));
+    ok = ok && torture<RingPages>(*shm, tracking, iterations, rng);
+  }
+
+  double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+  printf("%s, %.0f iterations per minute\n", ok ? "passed" : "FAILED", g_iterationsRun / seconds * 60);
+  return ok ? 0 : 1;
+}